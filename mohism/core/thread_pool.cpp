@@ -0,0 +1,118 @@
+#include "core/thread_pool.h"
+
+namespace MH
+{
+    ThreadPool::ThreadPool(unsigned int worker_count)
+    {
+        for(unsigned int i = 0; i < worker_count; i++)
+        {
+            m_workers.emplace_back(&ThreadPool::worker_main, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work.notify_all();
+
+        for(std::thread& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool& ThreadPool::get()
+    {
+        static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+        return pool;
+    }
+
+    void ThreadPool::parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& job)
+    {
+        if(count == 0)
+        {
+            return;
+        }
+
+        grain = std::max(grain, (size_t)1);
+        size_t chunk_count = (count + grain - 1) / grain;
+
+        if(chunk_count == 1 || m_workers.empty())
+        {
+            for(size_t begin = 0; begin < count; begin += grain)
+            {
+                job(begin, std::min(begin + grain, count));
+            }
+            return;
+        }
+
+        // shared, a worker may still hold the loop after its last chunk is claimed
+        auto loop = std::make_shared<Loop>();
+        loop->job = &job;
+        loop->count = count;
+        loop->grain = grain;
+        loop->chunk_count = chunk_count;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_loops.push_back(loop);
+        }
+        m_work.notify_all();
+
+        run_chunks(*loop);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [&loop]{ return loop->finished_chunks == loop->chunk_count; });
+
+        auto it = std::find(m_loops.begin(), m_loops.end(), loop);
+        if(it != m_loops.end())
+        {
+            m_loops.erase(it);
+        }
+    }
+
+    void ThreadPool::worker_main()
+    {
+        while(true)
+        {
+            std::shared_ptr<Loop> loop;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work.wait(lock, [this]{ return m_stop || !m_loops.empty(); });
+                if(m_stop)
+                {
+                    return;
+                }
+
+                loop = m_loops.front();
+                // every chunk is claimed, the owner waits for the running ones
+                if(loop->next_chunk >= loop->chunk_count)
+                {
+                    m_loops.pop_front();
+                    continue;
+                }
+            }
+
+            run_chunks(*loop);
+        }
+    }
+
+    void ThreadPool::run_chunks(Loop& loop)
+    {
+        size_t chunk;
+        while((chunk = loop.next_chunk.fetch_add(1)) < loop.chunk_count)
+        {
+            size_t begin = chunk * loop.grain;
+            (*loop.job)(begin, std::min(begin + loop.grain, loop.count));
+
+            if(loop.finished_chunks.fetch_add(1) + 1 == loop.chunk_count)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_finished.notify_all();
+            }
+        }
+    }
+} // namespace MH
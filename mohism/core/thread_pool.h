@@ -0,0 +1,50 @@
+#pragma once
+
+#include "core/core.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace MH
+{
+    // persistent workers for data parallel loops, the calling thread works on its own loop too,
+    // so loops may be nested inside jobs without starving the pool
+    class MH_API ThreadPool
+    {
+        public:
+            ThreadPool(unsigned int worker_count);
+            ~ThreadPool();
+
+            // runs job(begin, end) over [0, count) in chunks of grain indices and returns when all of them ran,
+            // chunk bounds only depend on count and grain, jobs writing by index give the same result on any core count
+            void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& job);
+
+            unsigned int get_worker_count() const { return m_workers.size(); }
+
+            // shared pool, one worker per hardware thread besides the caller
+            static ThreadPool& get();
+        private:
+            struct Loop
+            {
+                const std::function<void(size_t, size_t)>* job;
+                size_t count;
+                size_t grain;
+                size_t chunk_count;
+                std::atomic<size_t> next_chunk{0};
+                std::atomic<size_t> finished_chunks{0};
+            };
+
+            void worker_main();
+            void run_chunks(Loop& loop);
+
+            std::vector<std::thread> m_workers;
+            std::deque<std::shared_ptr<Loop>> m_loops;
+            std::mutex m_mutex;
+            std::condition_variable m_work;
+            std::condition_variable m_finished;
+            bool m_stop = false;
+    };
+} // namespace MH
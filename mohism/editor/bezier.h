@@ -0,0 +1,166 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "glm/common.hpp"
+#include "bspline_basis.h"
+
+namespace MH
+{
+    // point at u in [0, 1] of the bezier curve with degree + 1 control points, de casteljau
+    template<typename T>
+    inline T evaluate_bezier(const T* points, int degree, float u)
+    {
+        assert(degree >= 0 && degree <= MAX_BSPLINE_DEGREE);
+
+        T temp[MAX_BSPLINE_DEGREE + 1];
+        for(int r = 0; r <= degree; r++)
+        {
+            temp[r] = points[r];
+        }
+
+        for(int j = 1; j <= degree; j++)
+        {
+            for(int r = 0; r <= degree - j; r++)
+            {
+                temp[r] = (1.0f - u) * temp[r] + u * temp[r + 1];
+            }
+        }
+        return temp[0];
+    }
+
+    // split at u into the control polygons of [0, u] and [u, 1], right may alias points
+    template<typename T>
+    inline void subdivide_bezier(const T* points, int degree, float u, T* left, T* right)
+    {
+        for(int r = 0; r <= degree; r++)
+        {
+            right[r] = points[r];
+        }
+
+        // level j of the scheme lives in right[0 .. degree - j], its last entry is final
+        left[0] = right[0];
+        for(int j = 1; j <= degree; j++)
+        {
+            for(int r = 0; r <= degree - j; r++)
+            {
+                right[r] = (1.0f - u) * right[r] + u * right[r + 1];
+            }
+            left[j] = right[0];
+        }
+    }
+
+    // axis aligned box of the control polygon, the curve lies inside by the convex hull property
+    inline void bezier_bounds(const glm::vec3* points, int degree, glm::vec3& min, glm::vec3& max)
+    {
+        min = points[0];
+        max = points[0];
+        for(int r = 1; r <= degree; r++)
+        {
+            min = glm::min(min, points[r]);
+            max = glm::max(max, points[r]);
+        }
+    }
+
+    // one knot insertion step at x in span, level j of the de boor scheme on points[j ... degree], in place
+    template<typename T>
+    inline void insert_knot_level(const float* knots, int span, int degree, int j, float x, T* points)
+    {
+        for(int r = degree; r >= j; r--)
+        {
+            int i = span - degree + r;
+            float alpha = (x - knots[i]) / (knots[i + degree + 1 - j] - knots[i]);
+            points[r] = (1.0f - alpha) * points[r - 1] + alpha * points[r];
+        }
+    }
+
+    // bezier control points of the b-spline piece over the non empty span [knots[span], knots[span + 1]]
+    // from its degree + 1 local control points, boehm insertion local to the span:
+    // inserting the span start degree - i times, then the span end i times, leaves bezier point i
+    template<typename T>
+    inline void span_to_bezier(const float* knots, int span, int degree, const T* local, T* result)
+    {
+        float t0 = knots[span];
+        float t1 = knots[span + 1];
+
+        // levels[j], the local control points after j insertions of t0
+        T levels[MAX_BSPLINE_DEGREE + 1][MAX_BSPLINE_DEGREE + 1];
+        T points[MAX_BSPLINE_DEGREE + 1];
+
+        std::copy(local, local + degree + 1, levels[0]);
+        for(int j = 1; j <= degree; j++)
+        {
+            std::copy(levels[j - 1], levels[j - 1] + degree + 1, levels[j]);
+            insert_knot_level(knots, span, degree, j, t0, levels[j]);
+        }
+
+        for(int i = 0; i <= degree; i++)
+        {
+            std::copy(levels[degree - i], levels[degree - i] + degree + 1, points);
+            for(int j = degree - i + 1; j <= degree; j++)
+            {
+                insert_knot_level(knots, span, degree, j, t1, points);
+            }
+            result[i] = points[degree];
+        }
+    }
+
+    // rational tensor patches, (degree_u + 1) x (degree_v + 1) homogeneous points (w * x, w * y, w * z, w), rows along v
+
+    // point at (u, v) in [0, 1]^2, de casteljau along v per row, then along u
+    inline glm::vec3 evaluate_bezier_patch(const glm::vec4* points, int degree_u, int degree_v, float u, float v)
+    {
+        glm::vec4 column[MAX_BSPLINE_DEGREE + 1];
+        for(int i = 0; i <= degree_u; i++)
+        {
+            column[i] = evaluate_bezier(points + i * (degree_v + 1), degree_v, v);
+        }
+        glm::vec4 point = evaluate_bezier(column, degree_u, u);
+        return glm::vec3(point) / point.w;
+    }
+
+    // split at u into the patches of [0, u] x [0, 1] and [u, 1] x [0, 1], right may alias points
+    inline void subdivide_bezier_patch_u(const glm::vec4* points, int degree_u, int degree_v, float u, glm::vec4* left, glm::vec4* right)
+    {
+        int width = degree_v + 1;
+        glm::vec4 column[MAX_BSPLINE_DEGREE + 1];
+        glm::vec4 left_column[MAX_BSPLINE_DEGREE + 1];
+        for(int j = 0; j < width; j++)
+        {
+            for(int i = 0; i <= degree_u; i++)
+            {
+                column[i] = points[i * width + j];
+            }
+            subdivide_bezier(column, degree_u, u, left_column, column);
+            for(int i = 0; i <= degree_u; i++)
+            {
+                left[i * width + j] = left_column[i];
+                right[i * width + j] = column[i];
+            }
+        }
+    }
+
+    // split at v into the patches of [0, 1] x [0, v] and [0, 1] x [v, 1], right may alias points
+    inline void subdivide_bezier_patch_v(const glm::vec4* points, int degree_u, int degree_v, float v, glm::vec4* left, glm::vec4* right)
+    {
+        int width = degree_v + 1;
+        for(int i = 0; i <= degree_u; i++)
+        {
+            subdivide_bezier(points + i * width, degree_v, v, left + i * width, right + i * width);
+        }
+    }
+
+    // axis aligned box of the projected control points, holds for the patch while every weight is positive
+    inline void bezier_patch_bounds(const glm::vec4* points, int degree_u, int degree_v, glm::vec3& min, glm::vec3& max)
+    {
+        int count = (degree_u + 1) * (degree_v + 1);
+        min = glm::vec3(points[0]) / points[0].w;
+        max = min;
+        for(int r = 1; r < count; r++)
+        {
+            glm::vec3 point = glm::vec3(points[r]) / points[r].w;
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+    }
+} // namespace MH
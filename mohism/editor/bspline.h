@@ -5,12 +5,64 @@
 #include "glad/glad.h"
 #include "core/log.h"
 #include "shader.h"
+#include "bspline_basis.h"
+#include "bspline_kernel.h"
+#include "bspline_batch.h"
+#include "bezier.h"
+#include "iso_curve.h"
+#include "bvh.h"
+#include "matrix.h"
+#include "core/thread_pool.h"
 #include <map>
-#include <tuple>
+#include <limits>
+#include <iterator>
 
 #define OPEN_KNOT_MODIFIED_UNIFORM_VECTOR 1
 #define FLOATING_UNIFORM_VECTOR 2
 
+#define SAMPLE_BY_PARAMETER 1
+#define SAMPLE_BY_FORWARD_DIFFERENCING 2
+#define SAMPLE_BY_ARC_LENGTH 3
+
+// forward differencing restarts from Horner every this many steps to bound float drift
+#define FORWARD_DIFFERENCING_RESEED 64
+#define MAX_SPAN_SAMPLES 1024
+
+// arc length table pieces per knot span, each integrated with 5 point gauss legendre and halved while the halves disagree
+#define ARC_LENGTH_SUBDIVISIONS 4
+#define ARC_LENGTH_MAX_DEPTH 6
+#define ARC_LENGTH_TOLERANCE 0.00001f
+#define ARC_LENGTH_NEWTON_STEPS 8
+
+// grid rows handed to a worker at a time when tessellating surfaces
+#define SURFACE_GRID_ROWS_PER_TASK 4
+
+// surface display products, each is built on its own when first displayed and kept until it is invalidated
+#define SURFACE_GENERAL_LINES 1
+#define SURFACE_KNOT_LINES 2
+#define SURFACE_NODAL_LINES 4
+#define SURFACE_SHADED_MESH 8
+#define SURFACE_PRODUCT_COUNT 4
+#define SURFACE_ALL_PRODUCTS 15
+// products drawn from the shared lit vertex grid
+#define SURFACE_GRID_PRODUCTS 9
+
+// quads of the adaptive tessellation are halved at most this many times inside a knot span cell
+#define ADAPTIVE_MAX_DEPTH 8
+
+// closest point queries seed newton with the nearest of (samples + 1)^2 points per candidate patch,
+// newton stops once the residual is this close to normal to the surface or the step this short in model units
+#define CLOSEST_POINT_PATCH_SAMPLES 4
+#define CLOSEST_POINT_NEWTON_STEPS 12
+#define CLOSEST_POINT_TOLERANCE 0.00001f
+#define CLOSEST_POINTS_PER_TASK 256
+
+// ray queries halve a patch this many times in u and v before newton starts from the center of a piece the ray box test kept,
+// a hit is a surface point this close to the ray in model units
+#define RAY_PATCH_MAX_DEPTH 5
+#define RAY_NEWTON_STEPS 8
+#define RAY_HIT_TOLERANCE 0.0001f
+
 namespace MH
 {
     class BSpline
@@ -63,7 +115,7 @@ namespace MH
         {
             control_points.erase(control_points.begin() + index);
             control_point_matrixes.erase(control_point_matrixes.begin() + index);
-            need_updated = true;
+            mark_need_update();
         }
         
         void add_control_point(glm::vec3 point)
@@ -71,7 +123,7 @@ namespace MH
             control_points.push_back(point);
             control_point_matrixes.push_back(calculate_control_point_matrix(point));
             
-            need_updated = true;
+            mark_need_update();
         }
         void add_control_points(std::vector<glm::vec3>& points)
         {
@@ -85,7 +137,7 @@ namespace MH
             }
             control_point_matrixes.insert(control_point_matrixes.end(), matrixes.begin(), matrixes.end());
             
-            need_updated = true;
+            mark_need_update();
         }
         
         void insert_control_point(size_t index, glm::vec3 point)
@@ -103,32 +155,33 @@ namespace MH
             control_points.insert(control_points.begin() + index, point);
             control_point_matrixes.insert(control_point_matrixes.begin() + index, calculate_control_point_matrix(point));
             
-            need_updated = true;
+            mark_need_update();
         }
         
         void remove_knot_vector(size_t index)
         {
             knot_vector.erase(knot_vector.begin() + index);
-            need_updated = true;
+            mark_need_update();
         }
         void add_knot_vector(float value)
         {
             knot_vector.push_back(value);
-            need_updated = true;
+            mark_need_update();
         }
         void add_knot_vector(std::vector<float>& values)
         {
             knot_vector.insert(knot_vector.end(), values.begin(), values.end());
-            need_updated = true;
+            mark_need_update();
         }
         void insert_knot_vector(size_t index, float value)
         {
             knot_vector.insert(knot_vector.begin() + index, value);
-            need_updated = true;
+            mark_need_update();
         }
         
         void generate_modified_open_knot_uniform_vector()
         {
+            invalidate_caches();
             knot_vector.clear();
             for(int i = 0; i < used_knot_num; i++)
             {
@@ -156,6 +209,7 @@ namespace MH
         
         void generate_float_uniform_knot_vector()
         {
+            invalidate_caches();
             knot_vector.clear();
             for(int i = 0; i < used_knot_num; i++)
             {
@@ -209,36 +263,11 @@ namespace MH
                 }
             }
             
-            for(int i = 0; i < used_knot_num - 1; i++)
-            {
-                if(t(i) < t(i+1))
-                {
-                    if(i > j_max)
-                    {
-                        j_max = i;
-                    }
-                }
-            }
-            
             domain.clear();
             domain.push_back(t(k()));
             domain.push_back(t(N() - k()));
         }
         
-        void calculate_jmax()
-        {
-            for(int i = 0; i < knot_vector.size() - 1; i++)
-            {
-                if(t(i) < t(i+1))
-                {
-                    if(i > j_max)
-                    {
-                        j_max = i;
-                    }
-                }
-            }
-        }
-        
         void update_render_data()
         {
             if(need_updated)
@@ -274,6 +303,13 @@ namespace MH
                 
                 glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
                 glEnableVertexAttribArray(0);
+                
+                dirty_begin = -1;
+                dirty_end = -1;
+            }
+            else if(dirty_begin != -1)
+            {
+                update_dirty_range();
             }
         }
         
@@ -306,6 +342,7 @@ namespace MH
         void set_degree(int value)
         {
             degree = value;
+            invalidate_caches();
         }
         
         int get_degree()
@@ -316,6 +353,22 @@ namespace MH
         void mark_need_update()
         {
             need_updated = true;
+            invalidate_caches();
+        }
+        
+        // a control point moved in place, knots and sample parameters stay valid, only its k + 1 spans are re-tessellated
+        void mark_control_point_moved(int index)
+        {
+            assert(index >= 0 && index < (int)control_points.size());
+            
+            dirty_begin = dirty_begin == -1 ? index : std::min(dirty_begin, index);
+            dirty_end = std::max(dirty_end, index);
+            
+            blending_cache_valid = false;
+            span_polynomials_valid = false;
+            bezier_segments_valid = false;
+            hodographs_valid = false;
+            arc_length_valid = false;
         }
         
         void set_dimension(int value)
@@ -331,410 +384,1931 @@ namespace MH
         
         glm::vec3 evaluate(float _t)
         {
-            glm::vec3 result(0.0f, 0.0f, 0.0f);
-            
-            for(int i = 0; i < control_points.size(); i++)
+            // not enough control points for this degree, the curve collapses to its first point
+            if(control_points.size() <= k())
             {
-                float blending_value = blending_func(i, k(), _t);
-                result += (blending_value * control_points[i]);
+                return control_points.empty() ? glm::vec3(0.0f, 0.0f, 0.0f) : control_points[0];
             }
             
-            return result;
+            // only P(span - k) ... P(span) have non zero blending value in this span
+            int span = find_span(_t);
+            return evaluate_curve_span(knot_vector.data(), span, k(), &control_points[span - k()], _t);
         }
         
-        float get_nodal_value(int i)
+        // first derivative dC/dt, position is returned through the same span lookup
+        glm::vec3 evaluate_derivative(float _t, glm::vec3* position = nullptr)
         {
-            float result = 0.0f;
-            for(int index = 1; index <= k(); index++)
+            glm::vec3 point(0.0f, 0.0f, 0.0f);
+            glm::vec3 derivative(0.0f, 0.0f, 0.0f);
+            
+            if(control_points.size() <= k())
             {
-                result += knot_vector[i + index];
+                point = evaluate(_t);
             }
-            float bottom = k();
-            result = result / bottom;
-            return result;
+            else
+            {
+                int span = find_span(_t);
+                evaluate_curve_derivative_span(knot_vector.data(), span, k(), &control_points[span - k()], _t, point, derivative);
+            }
+            
+            if(position != nullptr)
+            {
+                *position = point;
+            }
+            return derivative;
         }
         
-        std::map<std::tuple<int, int, float>, float> blending_cache;
-        
-    public:
-        float blending_func(int i, int _k, float _t)
+        // batch evaluation, positions of params[0 .. count) written to result[0 .. count)
+        void evaluate_many(const float* params, size_t count, glm::vec3* result)
         {
-            auto key = std::make_tuple(i, _k, _t);
-            auto it = blending_cache.find(key);
-            if(it != blending_cache.end())
+            if(count == 0)
             {
-                //element found;
-                return it->second;
+                return;
             }
-            
-            if(_k == 0)
+            evaluate_many(params, count, &result[0].x, &result[0].y, &result[0].z, 3);
+        }
+
+        // SoA variant, result i is written to x[i * stride], y[i * stride], z[i * stride]
+        void evaluate_many(const float* params, size_t count, float* x, float* y, float* z, size_t stride = 1)
+        {
+            if(control_points.size() <= k())
             {
-                if(_t == t(j_max + 1))
+                for(size_t i = 0; i < count; i++)
                 {
-                    blending_cache[key] = 1;
-                    return 1;
+                    glm::vec3 point = evaluate(params[i]);
+                    x[i * stride] = point.x;
+                    y[i * stride] = point.y;
+                    z[i * stride] = point.z;
                 }
-                
-                if(_t >= t(i) && _t < t(i + 1))
-                {
-                    blending_cache[key] = 1;
-                    return 1;
-                }
-                else
+                return;
+            }
+
+            evaluate_curve_batch(get_breakpoints(), knot_vector.data(), k(), control_points.data(), params, count, x, y, z, stride);
+        }
+
+        // position, first and second derivative of the curve at a parameter
+        struct DifferentialSample
+        {
+            glm::vec3 position;
+            glm::vec3 tangent;
+            glm::vec3 second_derivative;
+            float curvature;
+        };
+        
+        // batch differential evaluation, one span lookup per parameter feeds the curve and both cached hodographs
+        void evaluate_derivatives_many(const float* params, size_t count, DifferentialSample* result)
+        {
+            if(control_points.size() <= k())
+            {
+                for(size_t i = 0; i < count; i++)
                 {
-                    blending_cache[key] = 0;
-                    return 0;
+                    result[i].position = evaluate(params[i]);
+                    result[i].tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                    result[i].second_derivative = glm::vec3(0.0f, 0.0f, 0.0f);
+                    result[i].curvature = 0.0f;
                 }
+                return;
             }
-            else
+            
+            update_hodographs();
+            
+            const KnotBreakpoints& lookup = get_breakpoints();
+            const float* knots = knot_vector.data();
+            int hint = -1;
+            for(size_t i = 0; i < count; i++)
             {
-                assert(_k > 0);
-                if(t(i) < t(i + 1 + _k))
+                float _t = params[i];
+                int span = lookup.find_span(_t, hint);
+                auto& sample = result[i];
+                
+                // N(i + 1, p - 1) over the knots is N(i, p - 1) over the knots shifted by one, so the hodograph span is span - 1
+                sample.position = evaluate_curve_span(knots, span, k(), &control_points[span - k()], _t);
+                sample.tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                sample.second_derivative = glm::vec3(0.0f, 0.0f, 0.0f);
+                if(k() >= 1)
                 {
-                    float left_factor = (_t - t(i)) / (t(i + _k) - t(i));
-                    float left_blending = blending_func(i, _k - 1, _t);
-                    float left_result = left_factor * left_blending;
-                    
-                    if(left_blending == 0.0f)
-                    {
-                        left_result = 0.0f;
-                    }
-                    
-                    float right_factor = (t(i + 1 + _k) - _t)/(t(i + 1 + _k) - t(i + 1));
-                    float right_blending = blending_func(i + 1, _k - 1, _t);
-                    float right_result = right_factor * right_blending;
-                    
-                    if(right_blending == 0.0f)
-                    {
-                        right_result = 0.0f;
-                    }
-                    
-                    blending_cache[key] = left_result + right_result;
-                    return left_result + right_result;
+                    sample.tangent = evaluate_curve_span(knots + 1, span - 1, k() - 1, &first_hodograph[span - k()], _t);
                 }
-                else
+                if(k() >= 2)
                 {
-                    blending_cache[key] = 0;
-                    return 0;
+                    sample.second_derivative = evaluate_curve_span(knots + 2, span - 2, k() - 2, &second_hodograph[span - k()], _t);
                 }
+                
+                float speed = glm::length(sample.tangent);
+                sample.curvature = speed > 0.0f ? glm::length(glm::cross(sample.tangent, sample.second_derivative)) / (speed * speed * speed) : 0.0f;
             }
         }
         
-        bool show_polygon= false;
-        bool show_curve = true;
-        bool show_control_point = false;
-        bool is_special_color = false;
-        
-    private:
-        
-        glm::mat4 calculate_control_point_matrix(glm::vec3 point)
+        // arc length of the whole domain
+        float get_length()
         {
-            auto result = glm::translate(glm::mat4(1.0f), point);
-            return result;
+            update_arc_length_table();
+            return arc_lengths.empty() ? 0.0f : arc_lengths.back();
         }
         
-        void sample_line_segments(int sample_count = 300)
+        // parameter at arc length s from the domain start, s is clamped to [0, length]
+        float parameter_at_length(float s)
         {
-            line_segments.clear();
-            
-            float domain_length = domain[1] - domain[0];
-            
-            float delta = domain_length / (float)(sample_count + 2);
-            
-            line_segments.push_back(evaluate(domain[0]));
-            for(int i = 1; i <= sample_count; i ++)
+            update_arc_length_table();
+            if(arc_lengths.size() < 2)
             {
-                line_segments.push_back(evaluate(domain[0] + (i) * delta));
+                return domain_begin();
             }
-            line_segments.push_back(evaluate(domain[1]));
+            
+            s = std::min(std::max(s, 0.0f), arc_lengths.back());
+            size_t piece = std::upper_bound(arc_lengths.begin(), arc_lengths.end(), s) - arc_lengths.begin();
+            piece = std::min(std::max(piece, (size_t)1), arc_lengths.size() - 1) - 1;
+            return invert_arc_length(piece, s);
         }
         
-        
-        
-        inline int N()
+        glm::vec3 point_at_length(float s)
         {
-            return knot_vector.size() - 1;
+            return evaluate(parameter_at_length(s));
         }
         
-        inline int k()
+        // count points evenly spaced in arc length, both ends included
+        void sample_constant_speed(size_t count, glm::vec3* result)
         {
-            return degree;
+            if(count == 0)
+            {
+                return;
+            }
+            
+            update_arc_length_table();
+            
+            std::vector<float> params(count, domain_begin());
+            if(arc_lengths.size() >= 2)
+            {
+                float length = arc_lengths.back();
+                float delta = count > 1 ? length / (float)(count - 1) : 0.0f;
+                
+                // lengths are increasing, so the table piece only moves forward
+                size_t piece = 0;
+                for(size_t i = 0; i < count; i++)
+                {
+                    float s = (i + 1 == count && count > 1) ? length : i * delta;
+                    while(piece + 2 < arc_lengths.size() && arc_lengths[piece + 1] < s)
+                    {
+                        piece++;
+                    }
+                    params[i] = invert_arc_length(piece, s);
+                }
+            }
+            
+            evaluate_many(params.data(), count, result);
         }
         
-        int j_max = 0;
-        
-        
-        inline float t(int i)
+        int find_span(float _t)
         {
-            return knot_vector[i];
+            return get_breakpoints().find_span(_t);
         }
         
-        int knot_vector_type = OPEN_KNOT_MODIFIED_UNIFORM_VECTOR;
-        
-        bool need_save_knot_vector = false;
-        bool need_updated = false;
-        
-        std::vector<glm::vec3> control_points;
-        std::vector<glm::mat4> control_point_matrixes;
-        
-        int degree;
-        std::vector<float> knot_vector;
-        int used_knot_num;
-        
-        std::vector<float> domain;
-        
-        std::vector<float> vertices;
-        std::vector<glm::vec3> line_segments;
-        
-        int dimension;
-        
-        unsigned int VAO;
-        unsigned int VBO;
-    };
-    
-    class BSplineSurface
-    {
-    public:
-        BSplineSurface()
+        // hinted lookup for monotone parameter sequences, start with hint = -1
+        int find_span(float _t, int& hint)
         {
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
-            glGenVertexArrays(1, &NODAL_VAO);
-            glGenBuffers(1, &NODAL_VBO);
-            glGenVertexArrays(1, &KNOT_VAO);
-            glGenBuffers(1, &KNOT_VBO);
+            return get_breakpoints().find_span(_t, hint);
         }
         
-        ~BSplineSurface()
+        // distinct knots and multiplicities, rebuilt after the knot vector or degree changed
+        const KnotBreakpoints& get_breakpoints()
         {
-            glDeleteVertexArrays(1, &VAO);
-            glDeleteBuffers(1, &VBO);
-            glDeleteVertexArrays(1, &NODAL_VAO);
-            glDeleteBuffers(1, &NODAL_VBO);
-            glDeleteVertexArrays(1, &KNOT_VAO);
-            glDeleteBuffers(1, &KNOT_VBO);
+            if(!breakpoints_valid)
+            {
+                breakpoints.build(knot_vector.data(), knot_vector.size(), k());
+                breakpoints_valid = true;
+            }
+            return breakpoints;
         }
         
-        // m
-        std::vector<float> knot_u;
-        // n
-        std::vector<float> knot_v;
-        // m x n
-        std::vector<glm::vec4> control_points;
-        std::vector<glm::vec3> grid_points;
-        
-        std::vector<std::shared_ptr<BSpline>> nodal_curves;
-        
-        float sourceMatrix[50][50] = {};
-        float destMatrix[50][50] = {};
-        
-        int degree_u;
-        int degree_v;
-        
-        int knot_length_u;
-        int knot_length_v;
+        void basis_funcs(int span, float _t, float* basis)
+        {
+            compute_basis_funcs(knot_vector.data(), span, k(), _t, basis);
+        }
         
-        float get_nodal_blending_u(int i, int nodal_index)
+        float get_nodal_value(int i)
         {
-            float ustarVal = u_star(nodal_index);
-            if(ustarVal >= domain_u.y)
+            float result = 0.0f;
+            for(int index = 1; index <= k(); index++)
             {
-                ustarVal = domain_u.y - 0.0001f;
+                result += knot_vector[i + index];
             }
-            return model_u->blending_func(i, degree_u, ustarVal);
+            float bottom = k();
+            result = result / bottom;
+            return result;
         }
         
-        float get_nodal_blending_v(int i, int nodal_index)
+    public:
+        float blending_func(int i, int _k, float _t)
         {
-            float vstarVal = v_star(nodal_index);
-            if(vstarVal >= domain_v.y)
+            assert(_k == k());
+            
+            // callers sweep i with a fixed _t, so keep the basis of the last parameter around
+            if(_t != blending_cache_t || !blending_cache_valid)
             {
-                vstarVal = domain_v.y - 0.0001f;
+                blending_cache_span = find_span(_t);
+                basis_funcs(blending_cache_span, _t, blending_cache);
+                blending_cache_t = _t;
+                blending_cache_valid = true;
             }
-            return model_v->blending_func(i, degree_v, vstarVal);
+            
+            int r = i - (blending_cache_span - k());
+            if(r < 0 || r > k())
+            {
+                return 0.0f;
+            }
+            return blending_cache[r];
         }
         
-        void compute_domain()
+        // power basis coefficients of the curve restricted to knot span [t0, t0 + length)
+        struct SpanPolynomial
         {
-            left_u = degree_u;
-            right_u = knot_length_u - 1 - degree_u;
-            left_v = degree_v;
-            right_v = knot_length_v - 1 - degree_v;
-            
-            domain_u = glm::vec2(knot_u[degree_u], knot_u[knot_length_u - 1 - degree_u]);
-            domain_v = glm::vec2(knot_v[degree_v], knot_v[knot_length_v - 1 - degree_v]);
+            float t0;
+            // zero for empty spans
+            float length;
+            // C(t) = sum of coefficients[d] * u^d, u = (t - t0) / length
+            glm::vec3 coefficients[MAX_BSPLINE_DEGREE + 1];
+        };
+        
+        // one entry per knot span k ... n, built lazily and dropped whenever the curve is marked for update
+        const std::vector<SpanPolynomial>& get_span_polynomials()
+        {
+            update_span_polynomials();
+            return span_polynomials;
         }
         
-        void compute_model_spline()
+        // control polygon of the curve restricted to a non empty knot span [t0, t1]
+        struct BezierSegment
         {
-            model_u = std::make_shared<BSpline>();
-            model_u->set_degree(degree_u);
-            model_u->add_knot_vector(knot_u);
-            model_u->calculate_jmax();
-            
-            model_v = std::make_shared<BSpline>();
-            model_v->set_degree(degree_v);
-            model_v->add_knot_vector(knot_v);
-            model_v->calculate_jmax();
-        }
+            float t0;
+            float t1;
+            glm::vec3 points[MAX_BSPLINE_DEGREE + 1];
+        };
         
-        void compute_derived_data_for_nodal()
+        // one entry per non empty knot span, built lazily and dropped whenever the curve changes
+        const std::vector<BezierSegment>& get_bezier_segments()
         {
-            compute_segments();
-            compute_knot_segments();
-            compute_nodal_segments();
-            compute_center();
+            update_bezier_segments();
+            return bezier_segments;
         }
         
-        void compute_derived_date()
+        glm::vec3 evaluate_horner(float _t)
         {
-            compute_domain();
-            compute_model_spline();
-            compute_segments();
-            compute_knot_segments();
-            compute_nodal_segments();
-            compute_center();
+            if(control_points.size() <= k())
+            {
+                return evaluate(_t);
+            }
+            
+            update_span_polynomials();
+            int span = find_span(_t);
+            const auto& poly = span_polynomials[span - k()];
+            if(poly.length <= 0.0f)
+            {
+                return control_points[span - k()];
+            }
+            return horner(poly, (_t - poly.t0) / poly.length);
         }
         
-        void draw(Shader* shader)
+        // polyline over the whole domain, every span is split so that the chord error stays below tolerance
+        void sample_forward_differencing(float tolerance, std::vector<glm::vec3>& result)
         {
-            if(ForNodal)
+            result.clear();
+            
+            if(control_points.size() <= k())
             {
-                if(nodal_curvedisplay)
-                {
-                    for(int i = 0; i < nodal_curves.size(); i++)
-                    {
-                        auto curve = nodal_curves[i];
-                        curve->draw(shader);
-                    }
-                }
-                if(general_display)
-                {
-                    glBindVertexArray(VAO);
-                    shader->setVec4("customColor", glm::vec4(0.3f, 0.4f, 0.52f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, segments.size());
-                    glBindVertexArray(0);
-                }
-                if(nodal_display)
-                {
-                    glBindVertexArray(NODAL_VAO);
-                    shader->setVec4("customColor", glm::vec4(0.0f, 0.1f, 0.1f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, nodal_segments.size());
-                    glBindVertexArray(0);
-                }
-                if(knot_display)
-                {
-                    glBindVertexArray(KNOT_VAO);
-                    shader->setVec4("customColor", glm::vec4(0.3f, 0.7f, 0.52f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, knot_segments.size());
-                    glBindVertexArray(0);
-                }
+                result.push_back(evaluate(0.0f));
+                return;
             }
-            else
+            
+            update_span_polynomials();
+            tolerance = std::max(tolerance, 0.000001f);
+            
+            for(size_t i = 0; i < span_polynomials.size(); i++)
             {
-                if(general_display)
+                const auto& poly = span_polynomials[i];
+                if(poly.length <= 0.0f)
                 {
-                    glBindVertexArray(VAO);
-                    shader->setVec4("customColor", glm::vec4(0.3f, 0.4f, 0.52f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, segments.size());
-                    glBindVertexArray(0);
+                    continue;
                 }
-                if(nodal_display)
+                
+                // a step du deviates from its chord by at most du^2 / 8 * max|C''(u)|
+                float second_derivative_bound = 0.0f;
+                for(int d = 2; d <= k(); d++)
                 {
-                    glBindVertexArray(NODAL_VAO);
-                    shader->setVec4("customColor", glm::vec4(0.0f, 0.1f, 0.1f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, nodal_segments.size());
-                    glBindVertexArray(0);
+                    second_derivative_bound += d * (d - 1) * glm::length(poly.coefficients[d]);
                 }
-                if(knot_display)
+                int steps = (int)std::ceil(std::sqrt(second_derivative_bound / (8.0f * tolerance)));
+                steps = std::min(std::max(steps, 1), MAX_SPAN_SAMPLES);
+                
+                // the first point of a span is the last point of the previous one
+                if(!result.empty())
                 {
-                    glBindVertexArray(KNOT_VAO);
-                    shader->setVec4("customColor", glm::vec4(0.3f, 0.7f, 0.52f, 1.0f));
-                    glDrawArrays(GL_LINES, 0, knot_segments.size());
-                    glBindVertexArray(0);
+                    result.pop_back();
                 }
+                size_t offset = result.size();
+                result.resize(offset + steps + 1);
+                forward_difference(poly, 0.0f, 1.0f / steps, steps, &result[offset]);
             }
         }
         
-        std::map<std::pair<float, float>, glm::vec3> evaluateCache;
-        
-        glm::vec3 evaluate(float u, float v)
+        // count samples evenly spaced over the domain, both ends included
+        void sample_uniform(size_t count, glm::vec3* result)
         {
-            assert(domain_u.x <= u && u <= domain_u.y);
-            assert(domain_v.x <= v && v <= domain_v.y);
-            
-            if(u == domain_u.y)
+            if(count == 0)
             {
-                u -= 0.0001f;
+                return;
             }
             
-            if(v == domain_v.y)
+            int n = knot_vector.size() - k() - 2;
+            float begin = t(k());
+            float end = t(n + 1);
+            float delta = count > 1 ? (end - begin) / (float)(count - 1) : 0.0f;
+            
+            if(control_points.size() <= k())
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    result[i] = evaluate(begin + i * delta);
+                }
+                return;
+            }
+            
+            update_span_polynomials();
+            
+            // consecutive samples of the same span are equally spaced in u, walk them with forward differences
+            size_t i = 0;
+            int hint = -1;
+            while(i < count)
+            {
+                float param = (i == count - 1 && count > 1) ? end : begin + i * delta;
+                int span = find_span(param, hint);
+                const auto& poly = span_polynomials[span - k()];
+                float span_end = poly.t0 + poly.length;
+                
+                size_t last = i;
+                while(last + 1 < count - 1 && begin + (last + 1) * delta < span_end)
+                {
+                    last++;
+                }
+                if(last + 1 == count - 1 && span == last_non_empty_span())
+                {
+                    last++;
+                }
+                
+                // repeated knots collapsed the domain into an empty span, the samples stay on its first control point
+                if(poly.length <= 0.0f)
+                {
+                    std::fill(result + i, result + last + 1, control_points[span - k()]);
+                    i = last + 1;
+                    continue;
+                }
+                
+                forward_difference(poly, (param - poly.t0) / poly.length, delta / poly.length, last - i, &result[i]);
+                if(last == count - 1 && count > 1)
+                {
+                    result[last] = horner(poly, (end - poly.t0) / poly.length);
+                }
+                i = last + 1;
+            }
+        }
+        
+        bool show_polygon= false;
+        bool show_curve = true;
+        bool show_control_point = false;
+        bool is_special_color = false;
+        
+        int sample_mode = SAMPLE_BY_PARAMETER;
+        float sample_tolerance = 0.001f;
+        // evenly spaced samples need far fewer points than parameter samples for the same facets
+        int arc_length_sample_count = 120;
+        
+    private:
+        
+        void invalidate_caches()
+        {
+            breakpoints_valid = false;
+            blending_cache_valid = false;
+            span_polynomials_valid = false;
+            bezier_segments_valid = false;
+            hodographs_valid = false;
+            arc_length_valid = false;
+        }
+        
+        // refresh vertices of the dirty control points and of the samples whose spans they support, upload only those bytes
+        void update_dirty_range()
+        {
+            int begin = dirty_begin;
+            int end = dirty_end;
+            dirty_begin = -1;
+            dirty_end = -1;
+            
+            // adaptive sampling may change the sample count, degenerate curves have no sample table
+            if(sample_mode != SAMPLE_BY_PARAMETER || control_points.size() <= k() || sample_table.spans.size() != line_segments.size())
+            {
+                need_updated = true;
+                update_render_data();
+                return;
+            }
+            
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            
+            for(int i = begin; i <= end; i++)
+            {
+                vertices[i * 3 + 0] = control_points[i].x;
+                vertices[i * 3 + 1] = control_points[i].y;
+                vertices[i * 3 + 2] = control_points[i].z;
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, begin * 3 * sizeof(float), (end - begin + 1) * 3 * sizeof(float), &vertices[begin * 3]);
+            
+            // P(i) only supports the spans i ... i + k, sample spans are non decreasing
+            const auto& spans = sample_table.spans;
+            size_t first = std::lower_bound(spans.begin(), spans.end(), begin) - spans.begin();
+            size_t last = std::upper_bound(spans.begin(), spans.end(), end + k()) - spans.begin();
+            if(first >= last)
+            {
+                return;
+            }
+            
+            size_t offset = control_points.size();
+            for(size_t i = first; i < last; i++)
+            {
+                line_segments[i] = evaluate_sample(i);
+                const auto& point = line_segments[i];
+                vertices[(offset + i) * 3 + 0] = point.x;
+                vertices[(offset + i) * 3 + 1] = point.y;
+                vertices[(offset + i) * 3 + 2] = point.z;
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, (offset + first) * 3 * sizeof(float), (last - first) * 3 * sizeof(float), &vertices[(offset + first) * 3]);
+        }
+        
+        int last_non_empty_span()
+        {
+            return find_span(t(knot_vector.size() - k() - 1));
+        }
+        
+        glm::vec3 horner(const SpanPolynomial& poly, float u)
+        {
+            glm::vec3 result = poly.coefficients[k()];
+            for(int d = k() - 1; d >= 0; d--)
+            {
+                result = result * u + poly.coefficients[d];
+            }
+            return result;
+        }
+        
+        // steps + 1 points at u0, u0 + du, ... u0 + steps * du of one span
+        void forward_difference(const SpanPolynomial& poly, float u0, float du, int steps, glm::vec3* result)
+        {
+            glm::vec3 shifted[MAX_BSPLINE_DEGREE + 1];
+            glm::vec3 diffs[MAX_BSPLINE_DEGREE + 1];
+            // surjections[m][j] = j! * S(m, j), turns powers of the step index into forward differences
+            float surjections[MAX_BSPLINE_DEGREE + 1][MAX_BSPLINE_DEGREE + 1];
+            
+            surjections[0][0] = 1.0f;
+            for(int m = 1; m <= k(); m++)
+            {
+                surjections[m][0] = 0.0f;
+                surjections[m - 1][m] = 0.0f;
+                for(int j = 1; j <= m; j++)
+                {
+                    surjections[m][j] = j * (surjections[m - 1][j] + surjections[m - 1][j - 1]);
+                }
+            }
+            
+            for(int start = 0; start <= steps; start += FORWARD_DIFFERENCING_RESEED)
+            {
+                int count = std::min(FORWARD_DIFFERENCING_RESEED, steps + 1 - start);
+                
+                // the span polynomial as a polynomial of the step index: taylor shift to the run start, then scale by du
+                for(int d = 0; d <= k(); d++)
+                {
+                    shifted[d] = poly.coefficients[d];
+                }
+                float origin = u0 + start * du;
+                for(int i = 0; i < k(); i++)
+                {
+                    for(int d = k() - 1; d >= i; d--)
+                    {
+                        shifted[d] += origin * shifted[d + 1];
+                    }
+                }
+                float scale = 1.0f;
+                for(int d = 0; d <= k(); d++)
+                {
+                    shifted[d] *= scale;
+                    scale *= du;
+                }
+                
+                // exact difference table, no cancellation from differencing sampled values
+                for(int j = 0; j <= k(); j++)
+                {
+                    diffs[j] = glm::vec3(0.0f, 0.0f, 0.0f);
+                    for(int m = j; m <= k(); m++)
+                    {
+                        diffs[j] += surjections[m][j] * shifted[m];
+                    }
+                }
+                
+                for(int i = 0; i < count; i++)
+                {
+                    result[start + i] = diffs[0];
+                    for(int d = 0; d < k(); d++)
+                    {
+                        diffs[d] += diffs[d + 1];
+                    }
+                }
+            }
+        }
+        
+        // control points of the derivative of a degree p curve, Q(i) = p * (P(i + 1) - P(i)) / (t(i + p + 1) - t(i + 1)),
+        // its knot vector is the same knots without the first and last value
+        static void compute_hodograph(const float* knots, int p, const std::vector<glm::vec3>& points, std::vector<glm::vec3>& result)
+        {
+            result.resize(points.size() > 0 ? points.size() - 1 : 0);
+            for(size_t i = 0; i < result.size(); i++)
+            {
+                float length = knots[i + p + 1] - knots[i + 1];
+                result[i] = length > 0.0f ? (p / length) * (points[i + 1] - points[i]) : glm::vec3(0.0f, 0.0f, 0.0f);
+            }
+        }
+        
+        void update_hodographs()
+        {
+            if(hodographs_valid)
+            {
+                return;
+            }
+            hodographs_valid = true;
+            
+            compute_hodograph(knot_vector.data(), k(), control_points, first_hodograph);
+            compute_hodograph(knot_vector.data() + 1, k() - 1, first_hodograph, second_hodograph);
+        }
+        
+        float domain_begin()
+        {
+            return control_points.size() > k() ? t(k()) : 0.0f;
+        }
+        
+        // |C'(t)| with t inside span, read from the first hodograph
+        float speed_in_span(int span, float _t)
+        {
+            if(k() == 0)
+            {
+                return 0.0f;
+            }
+            return glm::length(evaluate_curve_span(knot_vector.data() + 1, span - 1, k() - 1, &first_hodograph[span - k()], _t));
+        }
+        
+        float integrate_speed(int span, float a, float b)
+        {
+            static const float nodes[5] = {-0.9061798459f, -0.5384693101f, 0.0f, 0.5384693101f, 0.9061798459f};
+            static const float weights[5] = {0.2369268851f, 0.4786286705f, 0.5688888889f, 0.4786286705f, 0.2369268851f};
+            
+            float center = 0.5f * (a + b);
+            float radius = 0.5f * (b - a);
+            float result = 0.0f;
+            for(int i = 0; i < 5; i++)
+            {
+                result += weights[i] * speed_in_span(span, center + radius * nodes[i]);
+            }
+            return result * radius;
+        }
+        
+        // arc length is monotone in t, newton steps are kept inside the bracket of the table piece
+        float invert_arc_length(size_t piece, float s)
+        {
+            float begin = arc_params[piece];
+            float low = begin;
+            float high = arc_params[piece + 1];
+            float base = arc_lengths[piece];
+            float length = arc_lengths[piece + 1] - base;
+            if(length <= 0.0f)
+            {
+                return begin;
+            }
+            
+            int span = arc_spans[piece];
+            float _t = low + (high - low) * (s - base) / length;
+            for(int i = 0; i < ARC_LENGTH_NEWTON_STEPS; i++)
+            {
+                float error = base + integrate_speed(span, begin, _t) - s;
+                if(std::abs(error) <= 0.000001f * arc_lengths.back())
+                {
+                    break;
+                }
+                
+                if(error > 0.0f)
+                {
+                    high = _t;
+                }
+                else
+                {
+                    low = _t;
+                }
+                
+                float speed = speed_in_span(span, _t);
+                float next = speed > 0.0f ? _t - error / speed : low - 1.0f;
+                _t = (next > low && next < high) ? next : 0.5f * (low + high);
+            }
+            return _t;
+        }
+        
+        void update_arc_length_table()
+        {
+            if(arc_length_valid)
+            {
+                return;
+            }
+            arc_length_valid = true;
+            arc_params.clear();
+            arc_lengths.clear();
+            arc_spans.clear();
+            
+            if(control_points.size() <= k())
+            {
+                return;
+            }
+            
+            update_hodographs();
+            
+            int n = knot_vector.size() - k() - 2;
+            arc_params.push_back(t(k()));
+            arc_lengths.push_back(0.0f);
+            for(int span = k(); span <= n; span++)
+            {
+                float begin = t(span);
+                float end = t(span + 1);
+                if(end <= begin)
+                {
+                    continue;
+                }
+                
+                for(int i = 1; i <= ARC_LENGTH_SUBDIVISIONS; i++)
+                {
+                    float a = arc_params.back();
+                    float b = i == ARC_LENGTH_SUBDIVISIONS ? end : begin + (end - begin) * i / ARC_LENGTH_SUBDIVISIONS;
+                    append_arc_length_piece(span, a, b, integrate_speed(span, a, b), ARC_LENGTH_MAX_DEPTH);
+                }
+            }
+        }
+        
+        void append_arc_length_piece(int span, float a, float b, float length, int depth)
+        {
+            float middle = 0.5f * (a + b);
+            float left = integrate_speed(span, a, middle);
+            float right = integrate_speed(span, middle, b);
+            if(depth > 0 && std::abs(left + right - length) > ARC_LENGTH_TOLERANCE * (left + right))
+            {
+                append_arc_length_piece(span, a, middle, left, depth - 1);
+                append_arc_length_piece(span, middle, b, right, depth - 1);
+                return;
+            }
+            
+            arc_lengths.push_back(arc_lengths.back() + left + right);
+            arc_params.push_back(b);
+            arc_spans.push_back(span);
+        }
+        
+        // one bezier segment per non empty span, see span_to_bezier
+        void update_bezier_segments()
+        {
+            if(bezier_segments_valid)
+            {
+                return;
+            }
+            bezier_segments_valid = true;
+            bezier_segments.clear();
+            
+            if(control_points.size() <= k())
+            {
+                return;
+            }
+            
+            int n = knot_vector.size() - k() - 2;
+            
+            for(int span = k(); span <= n; span++)
+            {
+                BezierSegment segment;
+                segment.t0 = t(span);
+                segment.t1 = t(span + 1);
+                if(segment.t1 <= segment.t0)
+                {
+                    continue;
+                }
+                
+                span_to_bezier(knot_vector.data(), span, k(), &control_points[span - k()], segment.points);
+                bezier_segments.push_back(segment);
+            }
+        }
+        
+        // the triangular scheme run on polynomials in u instead of numbers, then contracted with the control points
+        void update_span_polynomials()
+        {
+            if(span_polynomials_valid)
+            {
+                return;
+            }
+            span_polynomials_valid = true;
+            span_polynomials.clear();
+            
+            if(control_points.size() <= k())
+            {
+                return;
+            }
+            
+            int order = k() + 1;
+            int n = knot_vector.size() - k() - 2;
+            
+            // basis[r][d], coefficient of u^d of N(span - k + r, k)
+            float basis[MAX_BSPLINE_DEGREE + 1][MAX_BSPLINE_DEGREE + 1];
+            float saved[MAX_BSPLINE_DEGREE + 1];
+            float temp[MAX_BSPLINE_DEGREE + 1];
+            
+            span_polynomials.resize(n - k() + 1);
+            for(int span = k(); span <= n; span++)
+            {
+                auto& poly = span_polynomials[span - k()];
+                poly.t0 = t(span);
+                poly.length = t(span + 1) - t(span);
+                for(int d = 0; d < order; d++)
+                {
+                    poly.coefficients[d] = glm::vec3(0.0f, 0.0f, 0.0f);
+                }
+                
+                if(poly.length <= 0.0f)
+                {
+                    continue;
+                }
+                
+                for(int r = 0; r < order; r++)
+                {
+                    for(int d = 0; d < order; d++)
+                    {
+                        basis[r][d] = 0.0f;
+                    }
+                }
+                basis[0][0] = 1.0f;
+                
+                for(int j = 1; j <= k(); j++)
+                {
+                    for(int d = 0; d <= j; d++)
+                    {
+                        saved[d] = 0.0f;
+                    }
+                    
+                    for(int r = 0; r < j; r++)
+                    {
+                        // left and right are linear in u, their sum is a knot difference
+                        float left_0 = poly.t0 - t(span + 1 - j + r);
+                        float right_0 = t(span + r + 1) - poly.t0;
+                        float denominator = right_0 + left_0;
+                        
+                        for(int d = 0; d < j; d++)
+                        {
+                            temp[d] = basis[r][d] / denominator;
+                        }
+                        
+                        // basis[r] = saved + right * temp, saved = left * temp
+                        basis[r][0] = saved[0] + right_0 * temp[0];
+                        for(int d = 1; d <= j; d++)
+                        {
+                            float temp_d = d < j ? temp[d] : 0.0f;
+                            basis[r][d] = saved[d] + right_0 * temp_d - poly.length * temp[d - 1];
+                        }
+                        
+                        saved[0] = left_0 * temp[0];
+                        for(int d = 1; d <= j; d++)
+                        {
+                            float temp_d = d < j ? temp[d] : 0.0f;
+                            saved[d] = left_0 * temp_d + poly.length * temp[d - 1];
+                        }
+                    }
+                    
+                    for(int d = 0; d <= j; d++)
+                    {
+                        basis[j][d] = saved[d];
+                    }
+                }
+                
+                const glm::vec3* points = &control_points[span - k()];
+                for(int r = 0; r < order; r++)
+                {
+                    for(int d = 0; d < order; d++)
+                    {
+                        poly.coefficients[d] += basis[r][d] * points[r];
+                    }
+                }
+            }
+        }
+        
+        glm::mat4 calculate_control_point_matrix(glm::vec3 point)
+        {
+            auto result = glm::translate(glm::mat4(1.0f), point);
+            return result;
+        }
+        
+        void sample_line_segments(int sample_count = 300)
+        {
+            line_segments.clear();
+            
+            if(control_points.size() <= k())
+            {
+                line_segments.resize(sample_count + 2, evaluate(domain[0]));
+                return;
+            }
+            
+            if(sample_mode == SAMPLE_BY_FORWARD_DIFFERENCING)
+            {
+                sample_forward_differencing(sample_tolerance, line_segments);
+                return;
+            }
+            
+            if(sample_mode == SAMPLE_BY_ARC_LENGTH)
+            {
+                line_segments.resize(std::max(arc_length_sample_count, 2));
+                sample_constant_speed(line_segments.size(), line_segments.data());
+                return;
+            }
+            
+            update_sample_table(sample_count);
+            
+            line_segments.resize(sample_table.spans.size());
+            for(size_t i = 0; i < sample_table.spans.size(); i++)
+            {
+                line_segments[i] = evaluate_sample(i);
+            }
+        }
+        
+        // basis values are cached, a sample is only a sparse weighted sum of k + 1 control points
+        glm::vec3 evaluate_sample(size_t i)
+        {
+            int order = k() + 1;
+            const float* basis = &sample_table.basis[i * order];
+            const glm::vec3* points = &control_points[sample_table.spans[i] - k()];
+            
+            glm::vec3 result(0.0f, 0.0f, 0.0f);
+            for(int r = 0; r < order; r++)
+            {
+                result += (basis[r] * points[r]);
+            }
+            return result;
+        }
+        
+        // rebuild span indices and blending values of the sample parameters, only when knots, degree or sample count changed
+        void update_sample_table(int sample_count)
+        {
+            if(sample_table.degree == k() && sample_table.sample_count == sample_count && sample_table.knot_vector == knot_vector)
+            {
+                return;
+            }
+            
+            sample_table.degree = k();
+            sample_table.sample_count = sample_count;
+            sample_table.knot_vector = knot_vector;
+            
+            float domain_length = domain[1] - domain[0];
+            float delta = domain_length / (float)(sample_count + 2);
+            
+            sample_table.params.clear();
+            sample_table.params.push_back(domain[0]);
+            for(int i = 1; i <= sample_count; i ++)
+            {
+                sample_table.params.push_back(domain[0] + (i) * delta);
+            }
+            sample_table.params.push_back(domain[1]);
+            
+            int order = k() + 1;
+            sample_table.spans.resize(sample_table.params.size());
+            sample_table.basis.resize(sample_table.params.size() * order);
+            int hint = -1;
+            for(size_t i = 0; i < sample_table.params.size(); i++)
+            {
+                sample_table.spans[i] = find_span(sample_table.params[i], hint);
+                basis_funcs(sample_table.spans[i], sample_table.params[i], &sample_table.basis[i * order]);
+            }
+        }
+        
+        struct SampleTable
+        {
+            int degree = -1;
+            int sample_count = -1;
+            std::vector<float> knot_vector;
+            
+            std::vector<float> params;
+            std::vector<int> spans;
+            // k + 1 blending values per sample
+            std::vector<float> basis;
+        };
+        
+        inline int N()
+        {
+            return knot_vector.size() - 1;
+        }
+        
+        inline int k()
+        {
+            return degree;
+        }
+        
+        inline float t(int i)
+        {
+            return knot_vector[i];
+        }
+        
+        int knot_vector_type = OPEN_KNOT_MODIFIED_UNIFORM_VECTOR;
+        
+        bool need_save_knot_vector = false;
+        bool need_updated = false;
+        
+        std::vector<glm::vec3> control_points;
+        std::vector<glm::mat4> control_point_matrixes;
+        
+        int degree;
+        std::vector<float> knot_vector;
+        int used_knot_num;
+        
+        std::vector<float> domain;
+        
+        bool breakpoints_valid = false;
+        KnotBreakpoints breakpoints;
+        
+        bool span_polynomials_valid = false;
+        std::vector<SpanPolynomial> span_polynomials;
+        
+        bool bezier_segments_valid = false;
+        std::vector<BezierSegment> bezier_segments;
+        
+        // derivative curves over knot_vector + 1 and knot_vector + 2
+        bool hodographs_valid = false;
+        std::vector<glm::vec3> first_hodograph;
+        std::vector<glm::vec3> second_hodograph;
+        
+        // arc_lengths[i] is the length up to arc_params[i], piece i lies in knot span arc_spans[i]
+        bool arc_length_valid = false;
+        std::vector<float> arc_params;
+        std::vector<float> arc_lengths;
+        std::vector<int> arc_spans;
+        
+        bool blending_cache_valid = false;
+        float blending_cache_t = 0.0f;
+        int blending_cache_span = 0;
+        float blending_cache[MAX_BSPLINE_DEGREE + 1];
+        
+        // control points moved since the last upload, -1 when clean
+        int dirty_begin = -1;
+        int dirty_end = -1;
+        
+        std::vector<float> vertices;
+        std::vector<glm::vec3> line_segments;
+        SampleTable sample_table;
+        
+        int dimension;
+        
+        unsigned int VAO;
+        unsigned int VBO;
+    };
+    
+    // banded lu factors of the collocation matrices F(j, i) = N(i)(u*(j)) and G(j, i) = N(i)(v*(j))
+    // of nodal interpolation, they depend on the knot vectors and degrees only
+    struct NodalFactorization
+    {
+        BandedLUFactorization u;
+        BandedLUFactorization v;
+    };
+    
+    class BSplineSurface
+    {
+    public:
+        BSplineSurface()
+        {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+            glGenVertexArrays(1, &line_VAO);
+            glGenBuffers(1, &line_VBO);
+            glGenBuffers(1, &line_EBO);
+        }
+        
+        ~BSplineSurface()
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            glDeleteVertexArrays(1, &line_VAO);
+            glDeleteBuffers(1, &line_VBO);
+            glDeleteBuffers(1, &line_EBO);
+        }
+        
+        // m
+        std::vector<float> knot_u;
+        // n
+        std::vector<float> knot_v;
+        // m x n
+        std::vector<glm::vec4> control_points;
+        std::vector<glm::vec3> grid_points;
+        
+        std::vector<std::shared_ptr<BSpline>> nodal_curves;
+        
+        int degree_u;
+        int degree_v;
+        
+        int knot_length_u;
+        int knot_length_v;
+        
+        float get_nodal_blending_u(int i, int nodal_index)
+        {
+            float ustarVal = u_star(nodal_index);
+            if(ustarVal >= domain_u.y)
+            {
+                ustarVal = domain_u.y - 0.0001f;
+            }
+            return model_u->blending_func(i, degree_u, ustarVal);
+        }
+        
+        float get_nodal_blending_v(int i, int nodal_index)
+        {
+            float vstarVal = v_star(nodal_index);
+            if(vstarVal >= domain_v.y)
+            {
+                vstarVal = domain_v.y - 0.0001f;
+            }
+            return model_v->blending_func(i, degree_v, vstarVal);
+        }
+        
+        // control points of the surface through control point j of nodal curve i at (u*(j), v*(i)), F C G^T = H where
+        // row j of H holds control point j of every curve, two banded triangular solves once the surface holds the factorization,
+        // false when a collocation matrix is singular, domain and model splines must be computed
+        bool interpolate_nodal_curves()
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            int m = knot_length_u - degree_u - 1 - 1;
+            assert((int)nodal_curves.size() == n + 1);
+            
+            if(!nodal_factorization)
+            {
+                nodal_factorization = compute_nodal_factorization();
+            }
+            if(!nodal_factorization)
+            {
+                return false;
+            }
+            
+            // F X = H for x, y and z together, then C G^T = X as G C^T = X^T
+            Matrix X(m + 1, 3 * (n + 1));
+            for(int i = 0; i <= n; i++)
+            {
+                auto& points = nodal_curves[i]->get_control_points();
+                assert((int)points.size() == m + 1);
+                for(int j = 0; j <= m; j++)
+                {
+                    X(j, i) = points[j].x;
+                    X(j, (n + 1) + i) = points[j].y;
+                    X(j, 2 * (n + 1) + i) = points[j].z;
+                }
+            }
+            nodal_factorization->u.solve(X);
+            
+            Matrix CT(n + 1, 3 * (m + 1));
+            for(int i = 0; i <= n; i++)
+            {
+                for(int j = 0; j <= m; j++)
+                {
+                    for(int axis = 0; axis < 3; axis++)
+                    {
+                        CT(i, axis * (m + 1) + j) = X(j, axis * (n + 1) + i);
+                    }
+                }
+            }
+            nodal_factorization->v.solve(CT);
+            
+            control_points.resize((m + 1) * (n + 1));
+            for(int j = 0; j <= m; j++)
+            {
+                for(int i = 0; i <= n; i++)
+                {
+                    control_points[j * (n + 1) + i] = glm::vec4(CT(i, j), CT(i, (m + 1) + j), CT(i, 2 * (m + 1) + j), 1.0f);
+                }
+            }
+            
+            compute_derived_data_for_nodal();
+            return true;
+        }
+        
+        void compute_domain()
+        {
+            left_u = degree_u;
+            right_u = knot_length_u - 1 - degree_u;
+            left_v = degree_v;
+            right_v = knot_length_v - 1 - degree_v;
+            
+            domain_u = glm::vec2(knot_u[degree_u], knot_u[knot_length_u - 1 - degree_u]);
+            domain_v = glm::vec2(knot_v[degree_v], knot_v[knot_length_v - 1 - degree_v]);
+        }
+        
+        void compute_model_spline()
+        {
+            model_u = std::make_shared<BSpline>();
+            model_u->set_degree(degree_u);
+            model_u->add_knot_vector(knot_u);
+            
+            model_v = std::make_shared<BSpline>();
+            model_v->set_degree(degree_v);
+            model_v->add_knot_vector(knot_v);
+            
+            bezier_patches_valid = false;
+            nodal_factorization = nullptr;
+        }
+        
+        void compute_derived_data_for_nodal()
+        {
+            // the net was filled after compute_model_spline
+            bezier_patches_valid = false;
+            tessellate();
+            upload_render_data();
+        }
+        
+        void compute_derived_date()
+        {
+            compute_domain();
+            compute_model_spline();
+            tessellate();
+            upload_render_data();
+        }
+        
+        // cpu side of the derived data, no gl calls, surfaces may be tessellated on different threads
+        // once compute_domain and compute_model_spline ran for them, every displayed product is rebuilt
+        void tessellate()
+        {
+            invalidate_derived_data();
+            update_products();
+            compute_center();
+        }
+        
+        // builds the displayed products that are missing, hidden ones stay built, true when a product was built
+        bool update_products()
+        {
+            int missing = displayed_products() & ~built_products;
+            for(int index = 0; index < SURFACE_PRODUCT_COUNT; index++)
+            {
+                int product = 1 << index;
+                if(missing & product)
+                {
+                    compute_product(product, product_meshes[index]);
+                }
+            }
+            built_products |= missing;
+            return missing != 0;
+        }
+        
+        // the given products are dropped and rebuilt when next displayed, the others are kept
+        void invalidate_derived_data(int products = SURFACE_ALL_PRODUCTS)
+        {
+            for(int index = 0; index < SURFACE_PRODUCT_COUNT; index++)
+            {
+                if(products & (1 << index))
+                {
+                    product_meshes[index] = ProductMesh();
+                }
+            }
+            // the shared grid goes with the last product indexing into it
+            if((products & SURFACE_GRID_PRODUCTS) == SURFACE_GRID_PRODUCTS)
+            {
+                grid_vertices = std::vector<float>();
+            }
+            built_products &= ~products;
+        }
+        
+        // products needed by the current display toggles
+        int displayed_products() const
+        {
+            int result = 0;
+            result |= general_display ? SURFACE_GENERAL_LINES : 0;
+            result |= knot_display ? SURFACE_KNOT_LINES : 0;
+            result |= nodal_display ? SURFACE_NODAL_LINES : 0;
+            result |= shaded_display ? SURFACE_SHADED_MESH : 0;
+            return result;
+        }
+        
+        // render thread only, the lit buffers hold the shared grid and the shaded and general products,
+        // the line buffers the position only knot and nodal lines
+        void upload_render_data()
+        {
+            upload_products(VAO, VBO, EBO, 6, grid_vertices, SURFACE_GRID_PRODUCTS);
+            upload_products(line_VAO, line_VBO, line_EBO, 3, std::vector<float>(), SURFACE_KNOT_LINES | SURFACE_NODAL_LINES);
+        }
+        
+        // shaded_shader lights the shaded view with the mesh normals, without it the mesh is drawn flat with shader
+        void draw(Shader* shader, Shader* shaded_shader = nullptr)
+        {
+            // a toggle showed a product that is not built yet, only that product is built
+            if(update_products())
+            {
+                upload_render_data();
+            }
+            
+            if(ForNodal && nodal_curvedisplay)
+            {
+                for(int i = 0; i < nodal_curves.size(); i++)
+                {
+                    auto curve = nodal_curves[i];
+                    curve->draw(shader);
+                }
+            }
+            
+            glBindVertexArray(VAO);
+            if(shaded_display)
+            {
+                // pushed back in depth so the line views stay visible on the surface
+                glEnable(GL_POLYGON_OFFSET_FILL);
+                glPolygonOffset(1.0f, 1.0f);
+                Shader* mesh_shader = shaded_shader ? shaded_shader : shader;
+                mesh_shader->use();
+                mesh_shader->setVec4("customColor", glm::vec4(0.75f, 0.78f, 0.82f, 1.0f));
+                draw_indices(GL_TRIANGLES, product_ranges[3]);
+                glDisable(GL_POLYGON_OFFSET_FILL);
+                shader->use();
+            }
+            if(general_display)
+            {
+                shader->setVec4("customColor", glm::vec4(0.3f, 0.4f, 0.52f, 1.0f));
+                draw_indices(GL_LINES, product_ranges[0]);
+            }
+            
+            glBindVertexArray(line_VAO);
+            if(nodal_display)
+            {
+                shader->setVec4("customColor", glm::vec4(0.0f, 0.1f, 0.1f, 1.0f));
+                draw_indices(GL_LINES, product_ranges[2]);
+            }
+            if(knot_display)
+            {
+                shader->setVec4("customColor", glm::vec4(0.3f, 0.7f, 0.52f, 1.0f));
+                draw_indices(GL_LINES, product_ranges[1]);
+            }
+            glBindVertexArray(0);
+        }
+        
+        // parameter ranges (min, max) covered by the surface, set by compute_domain
+        glm::vec2 get_domain_u() const
+        {
+            return domain_u;
+        }
+        
+        glm::vec2 get_domain_v() const
+        {
+            return domain_v;
+        }
+        
+        // span local rational evaluation, only the (p + 1)(q + 1) non zero tensor basis values are computed
+        glm::vec3 evaluate(float u, float v)
+        {
+            assert(domain_u.x <= u && u <= domain_u.y);
+            assert(domain_v.x <= v && v <= domain_v.y);
+            
+            int span_u = model_u->find_span(u);
+            int span_v = model_v->find_span(v);
+            
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            
+            return evaluate_surface_span(knot_u.data(), span_u, degree_u, u,
+                                         knot_v.data(), span_v, degree_v, v,
+                                         &control_points[width * (span_u - degree_u) + (span_v - degree_v)], width);
+        }
+        
+        // position and the partial derivatives along u and v
+        void evaluate_derivatives(float u, float v, glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v)
+        {
+            int span_u = model_u->find_span(u);
+            int span_v = model_v->find_span(v);
+            
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            
+            evaluate_surface_derivative_span(knot_u.data(), span_u, degree_u, u,
+                                             knot_v.data(), span_v, degree_v, v,
+                                             &control_points[width * (span_u - degree_u) + (span_v - degree_v)], width,
+                                             position, derivative_u, derivative_v);
+        }
+        
+        // position, first and second partial derivatives
+        void evaluate_second_derivatives(float u, float v, glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v,
+                                         glm::vec3& derivative_uu, glm::vec3& derivative_uv, glm::vec3& derivative_vv)
+        {
+            int span_u = model_u->find_span(u);
+            int span_v = model_v->find_span(v);
+            
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            
+            evaluate_surface_second_derivative_span(knot_u.data(), span_u, degree_u, u,
+                                                    knot_v.data(), span_v, degree_v, v,
+                                                    &control_points[width * (span_u - degree_u) + (span_v - degree_v)], width,
+                                                    position, derivative_u, derivative_v, derivative_uu, derivative_uv, derivative_vv);
+        }
+        
+        // surface points at every (us[a], vs[b]), result[a * vs.size() + b], the tensor sum is split into
+        // B_u * P per u value, then * B_v^T per v value, so every basis row is built once,
+        // unit normals come from the same rows with the derivative bases when requested
+        void evaluate_grid(const std::vector<float>& us, const std::vector<float>& vs, std::vector<glm::vec3>& result,
+                           std::vector<glm::vec3>* normals = nullptr)
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            int order_u = degree_u + 1;
+            int order_v = degree_v + 1;
+            
+            result.resize(us.size() * vs.size());
+            if(normals != nullptr)
+            {
+                normals->resize(us.size() * vs.size());
+            }
+            
+            std::vector<glm::vec4> homogeneous = homogeneous_net();
+            
+            // spans are looked up here, the breakpoint tables of the model splines are built lazily and not shared safely
+            std::vector<int> spans_v(vs.size());
+            std::vector<float> basis_v(vs.size() * order_v);
+            std::vector<float> derivs_v(normals != nullptr ? vs.size() * order_v : 0);
+            int hint = -1;
+            for(size_t b = 0; b < vs.size(); b++)
+            {
+                spans_v[b] = model_v->find_span(vs[b], hint);
+                if(normals != nullptr)
+                {
+                    compute_basis_funcs_derivs(knot_v.data(), spans_v[b], degree_v, vs[b], &basis_v[b * order_v], &derivs_v[b * order_v]);
+                }
+                else
+                {
+                    compute_basis_funcs(knot_v.data(), spans_v[b], degree_v, vs[b], &basis_v[b * order_v]);
+                }
+            }
+            
+            std::vector<int> spans_u(us.size());
+            std::vector<float> basis_u(us.size() * order_u);
+            std::vector<float> derivs_u(normals != nullptr ? us.size() * order_u : 0);
+            hint = -1;
+            for(size_t a = 0; a < us.size(); a++)
+            {
+                spans_u[a] = model_u->find_span(us[a], hint);
+                if(normals != nullptr)
+                {
+                    compute_basis_funcs_derivs(knot_u.data(), spans_u[a], degree_u, us[a], &basis_u[a * order_u], &derivs_u[a * order_u]);
+                }
+                else
+                {
+                    compute_basis_funcs(knot_u.data(), spans_u[a], degree_u, us[a], &basis_u[a * order_u]);
+                }
+            }
+            
+            // rows are independent and written in place, the result does not depend on the scheduling
+            ThreadPool::get().parallel_for(us.size(), SURFACE_GRID_ROWS_PER_TASK, [&](size_t begin, size_t end)
+            {
+                std::vector<glm::vec4> row(width);
+                std::vector<glm::vec4> row_du(normals != nullptr ? width : 0);
+                for(size_t a = begin; a < end; a++)
+                {
+                    // one row of B_u * P, the control points of the iso curve at us[a]
+                    contract_net_u(homogeneous, spans_u[a], &basis_u[a * order_u], row.data());
+                    if(normals != nullptr)
+                    {
+                        contract_net_u(homogeneous, spans_u[a], &derivs_u[a * order_u], row_du.data());
+                    }
+                    
+                    glm::vec3* target = &result[a * vs.size()];
+                    for(size_t b = 0; b < vs.size(); b++)
+                    {
+                        const float* basis = &basis_v[b * order_v];
+                        const glm::vec4* points = &row[spans_v[b] - degree_v];
+                        
+                        glm::vec4 point(0.0f, 0.0f, 0.0f, 0.0f);
+                        for(int j = 0; j < order_v; j++)
+                        {
+                            point += basis[j] * points[j];
+                        }
+                        target[b] = glm::vec3(point) / point.w;
+                        
+                        if(normals == nullptr)
+                        {
+                            continue;
+                        }
+                        
+                        const float* derivs = &derivs_v[b * order_v];
+                        const glm::vec4* points_du = &row_du[spans_v[b] - degree_v];
+                        glm::vec4 du(0.0f, 0.0f, 0.0f, 0.0f);
+                        glm::vec4 dv(0.0f, 0.0f, 0.0f, 0.0f);
+                        for(int j = 0; j < order_v; j++)
+                        {
+                            du += basis[j] * points_du[j];
+                            dv += derivs[j] * points[j];
+                        }
+                        
+                        // quotient rule on the homogeneous sums
+                        glm::vec3 tangent_u = (glm::vec3(du) - du.w * target[b]) / point.w;
+                        glm::vec3 tangent_v = (glm::vec3(dv) - dv.w * target[b]) / point.w;
+                        glm::vec3 normal = glm::cross(tangent_u, tangent_v);
+                        float length = glm::length(normal);
+                        (*normals)[a * vs.size() + b] = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 0.0f);
+                    }
+                }
+            });
+        }
+        
+        // the curve v -> S(u, v), its control points are the net contracted with the u basis at u
+        IsoCurve iso_curve_u(float u)
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            
+            int span_u = model_u->find_span(u);
+            float basis_u[MAX_BSPLINE_DEGREE + 1];
+            compute_basis_funcs(knot_u.data(), span_u, degree_u, u, basis_u);
+            
+            std::vector<glm::vec4> points(n + 1);
+            contract_net_u(homogeneous_net(), span_u, basis_u, points.data());
+            return IsoCurve(degree_v, knot_v, std::move(points));
+        }
+        
+        // the curve u -> S(u, v)
+        IsoCurve iso_curve_v(float v)
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            int m = knot_length_u - degree_u - 1 - 1;
+            int width = n + 1;
+            
+            int span_v = model_v->find_span(v);
+            float basis_v[MAX_BSPLINE_DEGREE + 1];
+            compute_basis_funcs(knot_v.data(), span_v, degree_v, v, basis_v);
+            
+            std::vector<glm::vec4> homogeneous = homogeneous_net();
+            std::vector<glm::vec4> points(m + 1, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+            for(int i = 0; i <= m; i++)
+            {
+                const glm::vec4* net_row = &homogeneous[width * i + span_v - degree_v];
+                for(int j = 0; j <= degree_v; j++)
+                {
+                    points[i] += basis_v[j] * net_row[j];
+                }
+            }
+            return IsoCurve(degree_u, knot_u, std::move(points));
+        }
+        
+        // rational bezier patch over the non empty knot span cell [u0, u1] x [v0, v1], its (degree_u + 1) x (degree_v + 1)
+        // homogeneous control points start at offset in the patch point buffer, rows along v
+        struct BezierPatch
+        {
+            float u0;
+            float u1;
+            float v0;
+            float v1;
+            size_t offset;
+            // box of the control points, holds the patch by the convex hull property
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+        
+        // one entry per non empty knot span cell, built lazily and dropped whenever the knots or the net change
+        const std::vector<BezierPatch>& get_bezier_patches()
+        {
+            update_bezier_patches();
+            return bezier_patches;
+        }
+        
+        // control points of every patch back to back, ready for a tessellation shader
+        const std::vector<glm::vec4>& get_bezier_patch_points()
+        {
+            update_bezier_patches();
+            return bezier_patch_points;
+        }
+        
+        const glm::vec4* get_bezier_patch_points(const BezierPatch& patch)
+        {
+            update_bezier_patches();
+            return &bezier_patch_points[patch.offset];
+        }
+        
+        // foot point of a projection onto the surface
+        struct SurfacePoint
+        {
+            float u;
+            float v;
+            glm::vec3 position;
+            float distance;
+        };
+        
+        // nearest point of the surface in model space, patches are visited nearest box first and each is refined
+        // from its nearest sample by newton on (S - p) . S_u = (S - p) . S_v = 0
+        SurfacePoint closest_point(const glm::vec3& point)
+        {
+            update_bezier_patches();
+            return project(point);
+        }
+        
+        // closest_point of every point, split over the thread pool, the lazy tables are built before the workers start
+        void closest_points(const glm::vec3* points, size_t count, SurfacePoint* result)
+        {
+            update_bezier_patches();
+            model_u->get_breakpoints();
+            model_v->get_breakpoints();
+            
+            ThreadPool::get().parallel_for(count, CLOSEST_POINTS_PER_TASK, [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    result[i] = project(points[i]);
+                }
+            });
+        }
+        
+        // intersection of a ray with the surface, the ray point is origin + t * direction
+        struct SurfaceHit
+        {
+            float u;
+            float v;
+            float t;
+            glm::vec3 position;
+        };
+        
+        // first intersection with t >= 0, in model space, direction need not be unit length,
+        // patch boxes from the hierarchy then de casteljau pieces cull the ray before newton refines a hit
+        bool intersect_ray(const glm::vec3& origin, const glm::vec3& direction, SurfaceHit& hit)
+        {
+            update_bezier_patches();
+            
+            // the ray is where two planes through it meet, a hit zeroes the surface point's offset from both
+            RayQuery ray;
+            ray.origin = origin;
+            ray.direction = direction;
+            ray.inverse_direction = 1.0f / direction;
+            glm::vec3 axis = std::abs(direction.x) > std::abs(direction.y) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            ray.normal_a = glm::normalize(glm::cross(direction, axis));
+            ray.normal_b = glm::normalize(glm::cross(direction, ray.normal_a));
+            
+            bool found = false;
+            float limit = std::numeric_limits<float>::max();
+            patch_hierarchy.visit_ray(origin, direction, limit, [&](int item, float& patch_limit)
+            {
+                const BezierPatch& patch = bezier_patches[item];
+                if(intersect_patch(ray, &bezier_patch_points[patch.offset], patch.u0, patch.u1, patch.v0, patch.v1, 0, patch_limit, hit))
+                {
+                    found = true;
+                }
+            });
+            return found;
+        }
+        
+        glm::vec3 center;
+        glm::mat4 transform = glm::mat4(1.0f);
+        
+        bool shaded_display = false;
+        // shaded mesh from flatness driven quads instead of the uniform grid, tolerance in model units
+        bool adaptive_tessellation = false;
+        float adaptive_tolerance = 0.01f;
+        bool general_display = true;
+        bool nodal_display = false;
+        bool knot_display = false;
+        bool nodal_curvedisplay = true;
+        
+        bool ForNodal = false;
+        
+    private:
+        
+        // (w * x, w * y, w * z, w) of every control point, same layout as control_points
+        std::vector<glm::vec4> homogeneous_net()
+        {
+            std::vector<glm::vec4> result(control_points.size());
+            for(size_t i = 0; i < control_points.size(); i++)
+            {
+                const auto& point = control_points[i];
+                result[i] = glm::vec4(glm::vec3(point) * point.w, point.w);
+            }
+            return result;
+        }
+        
+        // row[j] = sum of N(span_u - p + i, p)(u) * net(span_u - p + i, j) with basis_u from span_u, rows of the net are contiguous
+        void contract_net_u(const std::vector<glm::vec4>& net, int span_u, const float* basis_u, glm::vec4* row)
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            
+            std::fill(row, row + width, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+            for(int i = 0; i <= degree_u; i++)
+            {
+                const glm::vec4* net_row = &net[width * (span_u - degree_u + i)];
+                for(int j = 0; j < width; j++)
+                {
+                    row[j] += basis_u[i] * net_row[j];
+                }
+            }
+        }
+        
+        // the local net of every cell goes to bezier form along v row by row, then along u column by column
+        void update_bezier_patches()
+        {
+            if(bezier_patches_valid)
+            {
+                return;
+            }
+            bezier_patches_valid = true;
+            bezier_patches.clear();
+            bezier_patch_points.clear();
+            
+            int n = knot_length_v - degree_v - 1 - 1;
+            int width = n + 1;
+            
+            int patch_width = degree_v + 1;
+            size_t patch_size = (degree_u + 1) * patch_width;
+            
+            std::vector<glm::vec4> net = homogeneous_net();
+            glm::vec4 column[MAX_BSPLINE_DEGREE + 1];
+            glm::vec4 bezier_column[MAX_BSPLINE_DEGREE + 1];
+            
+            for(int span_u = left_u; span_u < right_u; span_u++)
+            {
+                if(knot_u[span_u + 1] <= knot_u[span_u])
+                {
+                    continue;
+                }
+                for(int span_v = left_v; span_v < right_v; span_v++)
+                {
+                    if(knot_v[span_v + 1] <= knot_v[span_v])
+                    {
+                        continue;
+                    }
+                    
+                    BezierPatch patch;
+                    patch.u0 = knot_u[span_u];
+                    patch.u1 = knot_u[span_u + 1];
+                    patch.v0 = knot_v[span_v];
+                    patch.v1 = knot_v[span_v + 1];
+                    patch.offset = bezier_patch_points.size();
+                    
+                    bezier_patch_points.resize(patch.offset + patch_size);
+                    glm::vec4* points = &bezier_patch_points[patch.offset];
+                    
+                    for(int i = 0; i <= degree_u; i++)
+                    {
+                        span_to_bezier(knot_v.data(), span_v, degree_v, &net[width * (span_u - degree_u + i) + span_v - degree_v], points + i * patch_width);
+                    }
+                    for(int j = 0; j < patch_width; j++)
+                    {
+                        for(int i = 0; i <= degree_u; i++)
+                        {
+                            column[i] = points[i * patch_width + j];
+                        }
+                        span_to_bezier(knot_u.data(), span_u, degree_u, column, bezier_column);
+                        for(int i = 0; i <= degree_u; i++)
+                        {
+                            points[i * patch_width + j] = bezier_column[i];
+                        }
+                    }
+                    
+                    bezier_patch_bounds(points, degree_u, degree_v, patch.min, patch.max);
+                    bezier_patches.push_back(patch);
+                }
+            }
+            
+            std::vector<glm::vec3> mins(bezier_patches.size());
+            std::vector<glm::vec3> maxs(bezier_patches.size());
+            for(size_t i = 0; i < bezier_patches.size(); i++)
+            {
+                mins[i] = bezier_patches[i].min;
+                maxs[i] = bezier_patches[i].max;
+            }
+            patch_hierarchy.build(mins, maxs);
+        }
+        
+        // read only once the patches are built, safe to run on several threads, every patch whose box is nearer than
+        // the best foot point so far is refined from its nearest sample, so the hierarchy prunes with exact distances
+        SurfacePoint project(const glm::vec3& point)
+        {
+            if(bezier_patches.empty())
+            {
+                return refine_projection(point, domain_u.x, domain_v.x, domain_u, domain_v);
+            }
+            
+            SurfacePoint result;
+            result.distance = std::numeric_limits<float>::max();
+            float best_squared = std::numeric_limits<float>::max();
+            patch_hierarchy.visit_nearest(point, best_squared, [&](int item, float& bound)
+            {
+                const BezierPatch& patch = bezier_patches[item];
+                const glm::vec4* points = &bezier_patch_points[patch.offset];
+                
+                // a parameter on a shared edge is sampled by the patch evaluate picks for it, the surface may jump at repeated knots
+                int last_a = patch.u1 < domain_u.y ? CLOSEST_POINT_PATCH_SAMPLES - 1 : CLOSEST_POINT_PATCH_SAMPLES;
+                int last_b = patch.v1 < domain_v.y ? CLOSEST_POINT_PATCH_SAMPLES - 1 : CLOSEST_POINT_PATCH_SAMPLES;
+                float nearest = std::numeric_limits<float>::max();
+                float u = patch.u0;
+                float v = patch.v0;
+                for(int a = 0; a <= last_a; a++)
+                {
+                    for(int b = 0; b <= last_b; b++)
+                    {
+                        float s = a / (float)CLOSEST_POINT_PATCH_SAMPLES;
+                        float t = b / (float)CLOSEST_POINT_PATCH_SAMPLES;
+                        glm::vec3 offset = evaluate_bezier_patch(points, degree_u, degree_v, s, t) - point;
+                        float distance = glm::dot(offset, offset);
+                        if(distance < nearest)
+                        {
+                            nearest = distance;
+                            u = patch.u0 + s * (patch.u1 - patch.u0);
+                            v = patch.v0 + t * (patch.v1 - patch.v0);
+                        }
+                    }
+                }
+                
+                SurfacePoint candidate = refine_projection(point, u, v, glm::vec2(patch.u0, patch.u1), glm::vec2(patch.v0, patch.v1));
+                if(candidate.distance < result.distance)
+                {
+                    result = candidate;
+                    bound = candidate.distance * candidate.distance;
+                }
+            });
+            return result;
+        }
+        
+        struct RayQuery
+        {
+            glm::vec3 origin;
+            glm::vec3 direction;
+            glm::vec3 inverse_direction;
+            glm::vec3 normal_a;
+            glm::vec3 normal_b;
+        };
+        
+        // the piece [u0, u1] x [v0, v1] of a patch with the homogeneous bezier points, halved in both directions
+        // while its control point box meets the ray before limit, a hit nearer than limit is stored and lowers it
+        bool intersect_patch(const RayQuery& ray, const glm::vec4* points, float u0, float u1, float v0, float v1, int depth,
+                             float& limit, SurfaceHit& hit)
+        {
+            glm::vec3 min, max;
+            bezier_patch_bounds(points, degree_u, degree_v, min, max);
+            float entry;
+            if(!intersect_ray_box(min, max, ray.origin, ray.inverse_direction, limit, entry))
             {
-                v -= 0.0001f;
+                return false;
             }
             
-            auto key = std::make_pair(u, v);
-            auto it = evaluateCache.find(key);
-            if(it != evaluateCache.end())
+            if(depth == RAY_PATCH_MAX_DEPTH)
             {
-                return it->second;
+                return refine_ray_hit(ray, u0, u1, v0, v1, limit, hit);
             }
             
-            int n = knot_length_v - degree_v - 1 - 1;
-            int m = knot_length_u - degree_u - 1 - 1;
+            glm::vec4 left[(MAX_BSPLINE_DEGREE + 1) * (MAX_BSPLINE_DEGREE + 1)];
+            glm::vec4 right[(MAX_BSPLINE_DEGREE + 1) * (MAX_BSPLINE_DEGREE + 1)];
+            glm::vec4 lower[(MAX_BSPLINE_DEGREE + 1) * (MAX_BSPLINE_DEGREE + 1)];
+            subdivide_bezier_patch_u(points, degree_u, degree_v, 0.5f, left, right);
             
-            glm::vec3 result = glm::vec3(0.0f, 0.0f, 0.0f);
+            float u_middle = 0.5f * (u0 + u1);
+            float v_middle = 0.5f * (v0 + v1);
+            bool found = false;
             
-            for(int i = 0; i <= m; i++)
+            // right and left are split in place, the upper half of v overwrites its input
+            subdivide_bezier_patch_v(left, degree_u, degree_v, 0.5f, lower, left);
+            found |= intersect_patch(ray, lower, u0, u_middle, v0, v_middle, depth + 1, limit, hit);
+            found |= intersect_patch(ray, left, u0, u_middle, v_middle, v1, depth + 1, limit, hit);
+            subdivide_bezier_patch_v(right, degree_u, degree_v, 0.5f, lower, right);
+            found |= intersect_patch(ray, lower, u_middle, u1, v0, v_middle, depth + 1, limit, hit);
+            found |= intersect_patch(ray, right, u_middle, u1, v_middle, v1, depth + 1, limit, hit);
+            return found;
+        }
+        
+        // newton on the offsets from both ray planes, from the center of the piece and clamped to it
+        bool refine_ray_hit(const RayQuery& ray, float u0, float u1, float v0, float v1, float& limit, SurfaceHit& hit)
+        {
+            float u = 0.5f * (u0 + u1);
+            float v = 0.5f * (v0 + v1);
+            for(int step = 0; step <= RAY_NEWTON_STEPS; step++)
             {
-                for(int j = 0; j <= n; j++)
+                glm::vec3 position, su, sv;
+                evaluate_derivatives(u, v, position, su, sv);
+                
+                glm::vec3 offset = position - ray.origin;
+                float fa = glm::dot(ray.normal_a, offset);
+                float fb = glm::dot(ray.normal_b, offset);
+                if(std::abs(fa) <= RAY_HIT_TOLERANCE && std::abs(fb) <= RAY_HIT_TOLERANCE)
+                {
+                    float t = glm::dot(offset, ray.direction) / glm::dot(ray.direction, ray.direction);
+                    if(t < 0.0f || t >= limit)
+                    {
+                        return false;
+                    }
+                    hit.u = u;
+                    hit.v = v;
+                    hit.t = t;
+                    hit.position = position;
+                    limit = t;
+                    return true;
+                }
+                
+                float a = glm::dot(ray.normal_a, su);
+                float b = glm::dot(ray.normal_a, sv);
+                float c = glm::dot(ray.normal_b, su);
+                float d = glm::dot(ray.normal_b, sv);
+                float determinant = a * d - b * c;
+                if(determinant == 0.0f)
                 {
-                    glm::vec4 control_point = P(i, j);
-                    glm::vec3 control_point_3d = glm::vec3(control_point.x, control_point.y, control_point.z);
-                    result += (blending(i, j, u, v) * control_point_3d);
+                    return false;
                 }
+                u = glm::clamp(u + (b * fb - d * fa) / determinant, u0, u1);
+                v = glm::clamp(v + (c * fa - a * fb) / determinant, v0, v1);
             }
-            
-            evaluateCache[key] = result;
-            // return (result / bottom_factor);
-            return result;
+            return false;
         }
         
-        glm::vec3 center;
-        glm::mat4 transform = glm::mat4(1.0f);
-        
-        bool general_display = true;
-        bool nodal_display = false;
-        bool knot_display = false;
-        bool nodal_curvedisplay = true;
-        
-        bool ForNodal = false;
-        
-    private:
-        
-        float blending(int i, int j, float u, float v)
+        // newton with the full hessian of |S - p|^2 / 2 inside range_u x range_v, gauss newton where it is not positive
+        // definite, steps are halved until the distance does not grow
+        SurfacePoint refine_projection(const glm::vec3& point, float u, float v, glm::vec2 range_u, glm::vec2 range_v)
         {
-            int n = knot_length_v - degree_v - 1 - 1;
-            int m = knot_length_u - degree_u - 1 - 1;
-            float bottom = 0.0f;
-            for(int ii = 0; ii <= m; ii++)
+            SurfacePoint result;
+            glm::vec3 su, sv, suu, suv, svv;
+            evaluate_second_derivatives(u, v, result.position, su, sv, suu, suv, svv);
+            result.u = u;
+            result.v = v;
+            result.distance = glm::length(result.position - point);
+            
+            for(int step = 0; step < CLOSEST_POINT_NEWTON_STEPS; step++)
             {
-                for(int jj = 0; jj <= n; jj++)
+                glm::vec3 residual = result.position - point;
+                float f = glm::dot(residual, su);
+                float g = glm::dot(residual, sv);
+                if(result.distance <= CLOSEST_POINT_TOLERANCE ||
+                   (std::abs(f) <= CLOSEST_POINT_TOLERANCE * glm::length(su) * result.distance &&
+                    std::abs(g) <= CLOSEST_POINT_TOLERANCE * glm::length(sv) * result.distance))
                 {
-                    
-                    glm::vec4 control_point_ii_jj = P(ii, jj);
-                    float scaler_ii_jj = control_point_ii_jj.w;
-                    bottom += (scaler_ii_jj * model_u->blending_func(ii, model_u->get_degree(), u)
-                    * model_v->blending_func(jj, model_v->get_degree(), v));
+                    break;
+                }
+                
+                float a = glm::dot(su, su) + glm::dot(residual, suu);
+                float b = glm::dot(su, sv) + glm::dot(residual, suv);
+                float c = glm::dot(sv, sv) + glm::dot(residual, svv);
+                if(a <= 0.0f || a * c - b * b <= 0.0f)
+                {
+                    a = glm::dot(su, su);
+                    b = glm::dot(su, sv);
+                    c = glm::dot(sv, sv);
+                }
+                float determinant = a * c - b * b;
+                
+                // a coordinate on the boundary whose descent direction leaves the range is held, both held is a corner minimum
+                bool hold_u = (u <= range_u.x && f > 0.0f) || (u >= range_u.y && f < 0.0f);
+                bool hold_v = (v <= range_v.x && g > 0.0f) || (v >= range_v.y && g < 0.0f);
+                float delta_u = 0.0f;
+                float delta_v = 0.0f;
+                if(hold_u && hold_v)
+                {
+                    break;
+                }
+                else if(hold_u && c > 0.0f)
+                {
+                    delta_v = -g / c;
+                }
+                else if(hold_v && a > 0.0f)
+                {
+                    delta_u = -f / a;
+                }
+                else if(!hold_u && !hold_v && determinant > 0.0f)
+                {
+                    delta_u = (b * g - c * f) / determinant;
+                    delta_v = (b * f - a * g) / determinant;
+                }
+                else
+                {
+                    break;
+                }
+                
+                bool accepted = false;
+                SurfacePoint next;
+                glm::vec3 next_su, next_sv, next_suu, next_suv, next_svv;
+                for(int halving = 0; halving < CLOSEST_POINT_NEWTON_STEPS && !accepted; halving++)
+                {
+                    next.u = glm::clamp(u + delta_u, range_u.x, range_u.y);
+                    next.v = glm::clamp(v + delta_v, range_v.x, range_v.y);
+                    evaluate_second_derivatives(next.u, next.v, next.position, next_su, next_sv, next_suu, next_suv, next_svv);
+                    next.distance = glm::length(next.position - point);
+                    accepted = next.distance <= result.distance;
+                    delta_u *= 0.5f;
+                    delta_v *= 0.5f;
+                }
+                if(!accepted)
+                {
+                    break;
+                }
+                
+                float moved = glm::length(next.position - result.position);
+                result = next;
+                u = next.u;
+                v = next.v;
+                su = next_su;
+                sv = next_sv;
+                suu = next_suu;
+                suv = next_suv;
+                svv = next_svv;
+                if(moved <= CLOSEST_POINT_TOLERANCE)
+                {
+                    break;
                 }
             }
-            
-            glm::vec4 control_point = P(i, j);
-            float scaler_i_j = control_point.w;
-            float top = scaler_i_j * model_u->blending_func(i, model_u->get_degree(), u)
-            * model_v->blending_func(j, model_v->get_degree(), v);
-            
-            return top / bottom;
+            return result;
         }
         
         glm::vec4 P(int i, int j)
@@ -745,160 +2319,470 @@ namespace MH
             return control_points[width * i + j];
         }
         
-        void compute_knot_segments()
+        // vertices, interleaved position and normal, and 32 bit indices into them of one display product
+        struct ProductMesh
+        {
+            std::vector<float> vertices;
+            std::vector<uint32_t> indices;
+        };
+        
+        // where one product lies in the gl buffers
+        struct IndexRange
+        {
+            size_t offset = 0;
+            size_t count = 0;
+            size_t base_vertex = 0;
+        };
+        
+        void draw_indices(GLenum mode, const IndexRange& range)
+        {
+            if(range.count > 0)
+            {
+                glDrawElementsBaseVertex(mode, range.count, GL_UNSIGNED_INT, (void*)(range.offset * sizeof(uint32_t)), range.base_vertex);
+            }
+        }
+        
+        // the shared vertices, then the vertices of every built product among products, each product with vertices
+        // of its own indexes them from its base vertex, the others index the shared ones, stride floats per vertex
+        void upload_products(unsigned int vao, unsigned int vbo, unsigned int ebo, int stride, const std::vector<float>& shared, int products)
         {
-            for(int i = left_u; i <= right_u; i++)
+            size_t vertex_count = shared.size() / stride;
+            size_t index_count = 0;
+            for(int index = 0; index < SURFACE_PRODUCT_COUNT; index++)
             {
-                float u = knot_u[i];
-                for(int j = left_v; j < right_v; j++)
+                if(products & (1 << index))
                 {
-                    float v = knot_v[j];
-                    float next_v = knot_v[j + 1];
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(u, next_v);
-                    knot_segments.push_back(a);
-                    knot_segments.push_back(b);
+                    const ProductMesh& mesh = product_meshes[index];
+                    IndexRange& range = product_ranges[index];
+                    range.offset = index_count;
+                    range.count = mesh.indices.size();
+                    range.base_vertex = mesh.vertices.empty() ? 0 : vertex_count;
+                    vertex_count += mesh.vertices.size() / stride;
+                    index_count += mesh.indices.size();
                 }
             }
             
-            for(int j = left_v; j <= right_v; j++)
+            glBindVertexArray(vao);
+            
+            // sized to the built products, shown or hidden
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertex_count * stride * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+            
+            if(!shared.empty())
+            {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, shared.size() * sizeof(float), shared.data());
+            }
+            for(int index = 0; index < SURFACE_PRODUCT_COUNT; index++)
             {
-                float v = knot_v[j];
-                for(int i = left_u; i < right_u; i++)
+                const ProductMesh& mesh = product_meshes[index];
+                const IndexRange& range = product_ranges[index];
+                if(!(products & (1 << index)) || mesh.indices.empty())
+                {
+                    continue;
+                }
+                if(!mesh.vertices.empty())
                 {
-                    float u = knot_u[i];
-                    float next_u = knot_u[i + 1];
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(next_u, v);
-                    knot_segments.push_back(a);
-                    knot_segments.push_back(b);
+                    glBufferSubData(GL_ARRAY_BUFFER, range.base_vertex * stride * sizeof(float), mesh.vertices.size() * sizeof(float), mesh.vertices.data());
                 }
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.offset * sizeof(uint32_t), mesh.indices.size() * sizeof(uint32_t), mesh.indices.data());
             }
             
-            for(int i = 0; i < knot_segments.size(); i++)
+            // position, then the unit normal for lit shaders when there is one
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            if(stride == 6)
             {
-                auto point = knot_segments[i];
-                knot_vertices.push_back(point.x);
-                knot_vertices.push_back(point.y);
-                knot_vertices.push_back(point.z);
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(3 * sizeof(float)));
+                glEnableVertexAttribArray(1);
             }
             
-            glBindVertexArray(KNOT_VAO);
-            
-            glBindBuffer(GL_ARRAY_BUFFER, KNOT_VBO);
-            glBufferData(GL_ARRAY_BUFFER, knot_vertices.size() * sizeof(float), &knot_vertices[0], GL_DYNAMIC_DRAW);
-            
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(0);
+            glBindVertexArray(0);
+        }
+        
+        // sub + 1 parameters evenly spread over the domain, the last one exactly at its end
+        static std::vector<float> uniform_params(const glm::vec2& domain, int sub)
+        {
+            std::vector<float> result;
+            for(int step_index = 0; step_index <= sub; step_index++)
+            {
+                result.push_back(step_index == sub ? domain.y : domain.x + (domain.y - domain.x) / (float)sub * step_index);
+            }
+            return result;
         }
         
-        void compute_nodal_segments()
+        // one display product, the general lines and the grid triangles are index lists into the shared grid, the adaptive
+        // mesh has lit vertices of its own, knot and nodal lines have position only vertices sampled at least as finely as the grid
+        void compute_product(int product, ProductMesh& mesh, int sub_u = 20, int sub_v = 20)
         {
             int n = knot_length_v - degree_v - 1 - 1;
             int m = knot_length_u - degree_u - 1 - 1;
             
-            for(int i = 0; i <= m; i++)
+            mesh = ProductMesh();
+            std::vector<float> general_us = uniform_params(domain_u, sub_u);
+            std::vector<float> general_vs = uniform_params(domain_v, sub_v);
+            
+            if(product == SURFACE_SHADED_MESH && adaptive_tessellation)
+            {
+                append_adaptive_mesh(mesh);
+            }
+            else if(product == SURFACE_SHADED_MESH)
+            {
+                compute_shared_grid(general_us, general_vs);
+                append_grid_triangles(general_us.size(), general_vs.size(), mesh);
+            }
+            else if(product == SURFACE_GENERAL_LINES)
+            {
+                compute_shared_grid(general_us, general_vs);
+                append_grid_lines(general_us.size(), general_vs.size(), mesh);
+            }
+            else if(product == SURFACE_KNOT_LINES)
             {
-                float u = u_star(i);
-                for(int j = 0; j < n; j++)
+                std::vector<float> knot_us(knot_u.begin() + left_u, knot_u.begin() + right_u + 1);
+                std::vector<float> knot_vs(knot_v.begin() + left_v, knot_v.begin() + right_v + 1);
+                append_cross_lines(knot_us, knot_vs, general_us, general_vs, mesh);
+            }
+            else if(product == SURFACE_NODAL_LINES)
+            {
+                std::vector<float> nodal_us;
+                std::vector<float> nodal_vs;
+                for(int i = 0; i <= m; i++)
+                {
+                    nodal_us.push_back(u_star(i));
+                }
+                for(int j = 0; j <= n; j++)
                 {
-                    float v = v_star(j);
-                    float next_v = v_star(j + 1);
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(u, next_v);
-                    nodal_segments.push_back(a);
-                    nodal_segments.push_back(b);
+                    nodal_vs.push_back(v_star(j));
                 }
+                append_cross_lines(nodal_us, nodal_vs, general_us, general_vs, mesh);
+            }
+        }
+        
+        // surface points and unit normals on us x vs, rows over us, once per invalidation of the grid products
+        void compute_shared_grid(const std::vector<float>& us, const std::vector<float>& vs)
+        {
+            if(!grid_vertices.empty())
+            {
+                return;
             }
             
-            for(int j = 0; j <= n; j++)
+            std::vector<glm::vec3> positions;
+            std::vector<glm::vec3> normals;
+            evaluate_grid(us, vs, positions, &normals);
+            
+            grid_vertices.resize(positions.size() * 6);
+            for(size_t i = 0; i < positions.size(); i++)
+            {
+                grid_vertices[i * 6 + 0] = positions[i].x;
+                grid_vertices[i * 6 + 1] = positions[i].y;
+                grid_vertices[i * 6 + 2] = positions[i].z;
+                grid_vertices[i * 6 + 3] = normals[i].x;
+                grid_vertices[i * 6 + 4] = normals[i].y;
+                grid_vertices[i * 6 + 5] = normals[i].z;
+            }
+        }
+        
+        // two triangles per cell of a rows x columns grid
+        static void append_grid_triangles(uint32_t rows, uint32_t columns, ProductMesh& mesh)
+        {
+            for(uint32_t a = 0; a + 1 < rows; a++)
             {
-                float v = v_star(j);
-                for(int i = 0; i < m; i++)
+                for(uint32_t b = 0; b + 1 < columns; b++)
                 {
-                    float u = u_star(i);
-                    float next_u = u_star(i + 1);
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(next_u, v);
-                    nodal_segments.push_back(a);
-                    nodal_segments.push_back(b);
+                    uint32_t corner = a * columns + b;
+                    mesh.indices.insert(mesh.indices.end(), {corner, corner + columns, corner + 1});
+                    mesh.indices.insert(mesh.indices.end(), {corner + 1, corner + columns, corner + columns + 1});
                 }
             }
-            
-            for(int i = 0; i < nodal_segments.size(); i++)
+        }
+        
+        // every row and column of a rows x columns grid
+        static void append_grid_lines(uint32_t rows, uint32_t columns, ProductMesh& mesh)
+        {
+            for(uint32_t a = 0; a < rows; a++)
             {
-                auto point = nodal_segments[i];
-                nodal_vertices.push_back(point.x);
-                nodal_vertices.push_back(point.y);
-                nodal_vertices.push_back(point.z);
+                for(uint32_t b = 0; b + 1 < columns; b++)
+                {
+                    mesh.indices.insert(mesh.indices.end(), {a * columns + b, a * columns + b + 1});
+                }
+            }
+            for(uint32_t b = 0; b < columns; b++)
+            {
+                for(uint32_t a = 0; a + 1 < rows; a++)
+                {
+                    mesh.indices.insert(mesh.indices.end(), {a * columns + b, (a + 1) * columns + b});
+                }
             }
-            
-            glBindVertexArray(NODAL_VAO);
-            
-            glBindBuffer(GL_ARRAY_BUFFER, NODAL_VBO);
-            glBufferData(GL_ARRAY_BUFFER, nodal_vertices.size() * sizeof(float), &nodal_vertices[0], GL_DYNAMIC_DRAW);
-            
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(0);
         }
         
-        void compute_segments(int sub_u = 20, int sub_v = 20)
+        // the u lines at line_us and the v lines at line_vs, each runs between the first and last parameter of the other
+        // direction through those parameters and the sample parameters inside that range, the u lines are evaluated whole
+        // and the v lines only between them so crossings are shared, positions only
+        void append_cross_lines(const std::vector<float>& line_us, const std::vector<float>& line_vs,
+                                const std::vector<float>& sample_us, const std::vector<float>& sample_vs, ProductMesh& mesh)
         {
-            float length_u = domain_u.y - domain_u.x;
-            float step_u = length_u / (float)sub_u;
+            if(line_us.empty() || line_vs.empty())
+            {
+                return;
+            }
             
-            float length_v = domain_v.y - domain_v.x;
-            float step_v = length_v / (float)sub_v;
+            // repeated knots give one line
+            std::vector<float> us = merge_params(line_us, {});
+            std::vector<float> vs = merge_params(line_vs, {});
+            std::vector<float> along_us = merge_params(us, sample_us, us.front(), us.back());
+            std::vector<float> along_vs = merge_params(vs, sample_vs, vs.front(), vs.back());
+            std::vector<float> between_us;
+            std::set_difference(along_us.begin(), along_us.end(), us.begin(), us.end(), std::back_inserter(between_us));
             
-            for(int step_index_u = 0; step_index_u <= sub_u; step_index_u++)
+            std::vector<glm::vec3> line_points;
+            std::vector<glm::vec3> between_points;
+            evaluate_grid(us, along_vs, line_points);
+            evaluate_grid(between_us, vs, between_points);
+            mesh.vertices.reserve((line_points.size() + between_points.size()) * 3);
+            for(const auto* points : {&line_points, &between_points})
             {
-                float u = domain_u.x + step_u * step_index_u;
-
-                for(int step_index_v = 0; step_index_v < sub_v; step_index_v++)
+                for(const auto& point : *points)
                 {
-                    float v = domain_v.x + step_v * step_index_v;
-                    float next_v = domain_v.x + step_v * (step_index_v + 1);
-
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(u, next_v);
-
-                    segments.push_back(a);
-                    segments.push_back(b);
+                    mesh.vertices.insert(mesh.vertices.end(), {point.x, point.y, point.z});
+                }
+            }
+            
+            uint32_t columns = along_vs.size();
+            for(uint32_t a = 0; a < us.size(); a++)
+            {
+                for(uint32_t b = 0; b + 1 < columns; b++)
+                {
+                    mesh.indices.insert(mesh.indices.end(), {a * columns + b, a * columns + b + 1});
                 }
             }
             
-            for(int step_index_v = 0; step_index_v <= sub_v; step_index_v++)
+            // along a v line the vertices alternate between u line crossings and the points between the u lines
+            uint32_t between_first = line_points.size();
+            for(uint32_t b = 0; b < vs.size(); b++)
+            {
+                uint32_t column = std::lower_bound(along_vs.begin(), along_vs.end(), vs[b]) - along_vs.begin();
+                uint32_t line = 0;
+                uint32_t between = 0;
+                uint32_t previous = 0;
+                for(size_t i = 0; i < along_us.size(); i++)
+                {
+                    uint32_t current;
+                    if(line < us.size() && us[line] == along_us[i])
+                    {
+                        current = line++ * columns + column;
+                    }
+                    else
+                    {
+                        current = between_first + between++ * vs.size() + b;
+                    }
+                    if(i > 0)
+                    {
+                        mesh.indices.insert(mesh.indices.end(), {previous, current});
+                    }
+                    previous = current;
+                }
+            }
+        }
+        
+        // parameter rectangle of the adaptive tessellation, corners are p00 = S(u0, v0), p10 = S(u1, v0), p01, p11
+        struct AdaptiveQuad
+        {
+            float u0, u1, v0, v1;
+        };
+        
+        static float distance_to_chord(const glm::vec3& point, const glm::vec3& a, const glm::vec3& b)
+        {
+            glm::vec3 chord = b - a;
+            float length = glm::length(chord);
+            if(length <= 0.0f)
+            {
+                return glm::length(point - a);
+            }
+            return glm::length(glm::cross(point - a, chord)) / length;
+        }
+        
+        // distance to the plane through the corner average spanned by the diagonals
+        static float distance_to_plane(const glm::vec3& point, const glm::vec3& p00, const glm::vec3& p10, const glm::vec3& p01, const glm::vec3& p11)
+        {
+            glm::vec3 normal = glm::cross(p11 - p00, p01 - p10);
+            float length = glm::length(normal);
+            glm::vec3 offset = point - 0.25f * (p00 + p10 + p01 + p11);
+            if(length <= 0.0f)
+            {
+                return glm::length(offset);
+            }
+            return std::abs(glm::dot(offset, normal)) / length;
+        }
+        
+        // halve the quad until its center is within adaptive_tolerance of the corner plane and its edge midpoints of the chords
+        void subdivide_adaptive(const AdaptiveQuad& quad, const glm::vec3& p00, const glm::vec3& p10, const glm::vec3& p01, const glm::vec3& p11,
+                                int depth, std::vector<AdaptiveQuad>& leaves)
+        {
+            if(depth < ADAPTIVE_MAX_DEPTH)
             {
-                float v = domain_v.x + step_v * step_index_v;
+                float um = 0.5f * (quad.u0 + quad.u1);
+                float vm = 0.5f * (quad.v0 + quad.v1);
+                
+                glm::vec3 bottom = evaluate(um, quad.v0);
+                glm::vec3 top = evaluate(um, quad.v1);
+                glm::vec3 left = evaluate(quad.u0, vm);
+                glm::vec3 right = evaluate(quad.u1, vm);
+                glm::vec3 center = evaluate(um, vm);
                 
-                for(int step_index_u = 0; step_index_u < sub_u; step_index_u++)
+                // geometric, a flat quad passes however uneven its parameterization is
+                float error = distance_to_plane(center, p00, p10, p01, p11);
+                error = std::max(error, distance_to_chord(bottom, p00, p10));
+                error = std::max(error, distance_to_chord(top, p01, p11));
+                error = std::max(error, distance_to_chord(left, p00, p01));
+                error = std::max(error, distance_to_chord(right, p10, p11));
+                
+                if(error > adaptive_tolerance)
                 {
-                    float u = domain_u.x + step_u * step_index_u;
-                    float next_u = domain_u.x + step_u * (step_index_u + 1);
-                    
-                    glm::vec3 a = evaluate(u, v);
-                    glm::vec3 b = evaluate(next_u, v);
-                    
-                    segments.push_back(a);
-                    segments.push_back(b);
+                    subdivide_adaptive({quad.u0, um, quad.v0, vm}, p00, bottom, left, center, depth + 1, leaves);
+                    subdivide_adaptive({um, quad.u1, quad.v0, vm}, bottom, p10, center, right, depth + 1, leaves);
+                    subdivide_adaptive({quad.u0, um, vm, quad.v1}, left, center, p01, top, depth + 1, leaves);
+                    subdivide_adaptive({um, quad.u1, vm, quad.v1}, center, right, top, p11, depth + 1, leaves);
+                    return;
+                }
+            }
+            leaves.push_back(quad);
+        }
+        
+        // adaptive triangles appended to the mesh, every knot span cell is refined on its own, leaves with finer
+        // neighbours take the neighbours' edge vertices into a fan around their center, so no t junction cracks
+        void append_adaptive_mesh(ProductMesh& mesh)
+        {
+            std::vector<AdaptiveQuad> leaves;
+            for(int i = left_u; i < right_u; i++)
+            {
+                for(int j = left_v; j < right_v; j++)
+                {
+                    AdaptiveQuad quad = {knot_u[i], knot_u[i + 1], knot_v[j], knot_v[j + 1]};
+                    if(quad.u1 <= quad.u0 || quad.v1 <= quad.v0)
+                    {
+                        continue;
+                    }
+                    subdivide_adaptive(quad, evaluate(quad.u0, quad.v0), evaluate(quad.u1, quad.v0),
+                                       evaluate(quad.u0, quad.v1), evaluate(quad.u1, quad.v1), 0, leaves);
                 }
             }
             
-            for(int i = 0; i < segments.size(); i++)
+            // midpoints always come from the same two end values, so shared corners compare exactly
+            std::map<float, std::vector<float>> vertices_at_u;
+            std::map<float, std::vector<float>> vertices_at_v;
+            for(const auto& quad : leaves)
+            {
+                vertices_at_u[quad.u0].insert(vertices_at_u[quad.u0].end(), {quad.v0, quad.v1});
+                vertices_at_u[quad.u1].insert(vertices_at_u[quad.u1].end(), {quad.v0, quad.v1});
+                vertices_at_v[quad.v0].insert(vertices_at_v[quad.v0].end(), {quad.u0, quad.u1});
+                vertices_at_v[quad.v1].insert(vertices_at_v[quad.v1].end(), {quad.u0, quad.u1});
+            }
+            for(auto* lines : {&vertices_at_u, &vertices_at_v})
             {
-                auto point = segments[i];
-                vertices.push_back(point.x);
-                vertices.push_back(point.y);
-                vertices.push_back(point.z);
+                for(auto& line : *lines)
+                {
+                    std::sort(line.second.begin(), line.second.end());
+                    line.second.erase(std::unique(line.second.begin(), line.second.end()), line.second.end());
+                }
             }
             
-            glBindVertexArray(VAO);
+            std::map<std::pair<float, float>, uint32_t> indices;
+            auto vertex = [&](float u, float v)
+            {
+                auto it = indices.find(std::make_pair(u, v));
+                if(it != indices.end())
+                {
+                    return it->second;
+                }
+                
+                glm::vec3 position;
+                glm::vec3 derivative_u;
+                glm::vec3 derivative_v;
+                evaluate_derivatives(u, v, position, derivative_u, derivative_v);
+                glm::vec3 normal = glm::cross(derivative_u, derivative_v);
+                float length = glm::length(normal);
+                normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 0.0f);
+                
+                uint32_t index = mesh.vertices.size() / 6;
+                mesh.vertices.insert(mesh.vertices.end(), {position.x, position.y, position.z, normal.x, normal.y, normal.z});
+                indices[std::make_pair(u, v)] = index;
+                return index;
+            };
             
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_DYNAMIC_DRAW);
+            // vertices strictly between from and to on a line, in the order of travel
+            auto edge = [](const std::vector<float>& line, float from, float to, std::vector<float>& result)
+            {
+                result.clear();
+                auto low = std::upper_bound(line.begin(), line.end(), std::min(from, to));
+                auto high = std::lower_bound(line.begin(), line.end(), std::max(from, to));
+                result.assign(low, high);
+                if(from > to)
+                {
+                    std::reverse(result.begin(), result.end());
+                }
+            };
             
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(0);
+            std::vector<uint32_t> loop;
+            std::vector<float> between;
+            for(const auto& quad : leaves)
+            {
+                // counter clockwise in the parameter plane, same winding as the grid triangles
+                loop.clear();
+                loop.push_back(vertex(quad.u0, quad.v0));
+                edge(vertices_at_v[quad.v0], quad.u0, quad.u1, between);
+                for(float u : between)
+                {
+                    loop.push_back(vertex(u, quad.v0));
+                }
+                loop.push_back(vertex(quad.u1, quad.v0));
+                edge(vertices_at_u[quad.u1], quad.v0, quad.v1, between);
+                for(float v : between)
+                {
+                    loop.push_back(vertex(quad.u1, v));
+                }
+                loop.push_back(vertex(quad.u1, quad.v1));
+                edge(vertices_at_v[quad.v1], quad.u1, quad.u0, between);
+                for(float u : between)
+                {
+                    loop.push_back(vertex(u, quad.v1));
+                }
+                loop.push_back(vertex(quad.u0, quad.v1));
+                edge(vertices_at_u[quad.u0], quad.v1, quad.v0, between);
+                for(float v : between)
+                {
+                    loop.push_back(vertex(quad.u0, v));
+                }
+                
+                if(loop.size() == 4)
+                {
+                    mesh.indices.insert(mesh.indices.end(), {loop[0], loop[1], loop[2], loop[0], loop[2], loop[3]});
+                    continue;
+                }
+                
+                uint32_t center = vertex(0.5f * (quad.u0 + quad.u1), 0.5f * (quad.v0 + quad.v1));
+                for(size_t k = 0; k < loop.size(); k++)
+                {
+                    mesh.indices.insert(mesh.indices.end(), {center, loop[k], loop[(k + 1) % loop.size()]});
+                }
+            }
+        }
+        
+        // sorted union without repeated values, b only contributes the values inside [low, high]
+        static std::vector<float> merge_params(const std::vector<float>& a, const std::vector<float>& b,
+                                               float low = -std::numeric_limits<float>::max(), float high = std::numeric_limits<float>::max())
+        {
+            std::vector<float> result(a.begin(), a.end());
+            for(float value : b)
+            {
+                if(low <= value && value <= high)
+                {
+                    result.push_back(value);
+                }
+            }
+            std::sort(result.begin(), result.end());
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+            return result;
         }
         
         void compute_center()
@@ -977,6 +2861,38 @@ namespace MH
             return result;
         }
         
+        // factorization for the current knot vectors and degrees, null when a collocation matrix is singular
+        std::unique_ptr<NodalFactorization> compute_nodal_factorization()
+        {
+            int n = knot_length_v - degree_v - 1 - 1;
+            int m = knot_length_u - degree_u - 1 - 1;
+            
+            auto factorization = std::make_unique<NodalFactorization>();
+            factorization->u.reset(m + 1, degree_u, degree_u);
+            for(int j = 0; j <= m; j++)
+            {
+                for(int i = std::max(0, j - degree_u); i <= std::min(m, j + degree_u); i++)
+                {
+                    factorization->u.at(j, i) = get_nodal_blending_u(i, j);
+                }
+            }
+            
+            factorization->v.reset(n + 1, degree_v, degree_v);
+            for(int j = 0; j <= n; j++)
+            {
+                for(int i = std::max(0, j - degree_v); i <= std::min(n, j + degree_v); i++)
+                {
+                    factorization->v.at(j, i) = get_nodal_blending_v(i, j);
+                }
+            }
+            
+            if(!factorization->u.factor() || !factorization->v.factor())
+            {
+                return nullptr;
+            }
+            return factorization;
+        }
+        
         // min max
         glm::vec2 domain_u;
         glm::vec2 domain_v;
@@ -985,22 +2901,30 @@ namespace MH
         int left_v;
         int right_v;
         
-        std::vector<glm::vec3> segments;
-        std::vector<glm::vec3> nodal_segments;
-        std::vector<glm::vec3> knot_segments;
+        // interleaved position and normal on the general parameters, the general lines and the grid triangles index it
+        std::vector<float> grid_vertices;
+        // one per SURFACE_* product, at the index of its bit, empty until the product is built
+        ProductMesh product_meshes[SURFACE_PRODUCT_COUNT];
+        IndexRange product_ranges[SURFACE_PRODUCT_COUNT];
         
-        std::vector<float> vertices;
-        std::vector<float> nodal_vertices;
-        std::vector<float> knot_vertices;
+        // SURFACE_* products whose meshes are up to date
+        int built_products = 0;
         
-        unsigned int VAO;
-        unsigned int VBO;
+        bool bezier_patches_valid = false;
+        std::vector<BezierPatch> bezier_patches;
+        std::vector<glm::vec4> bezier_patch_points;
+        BoundingVolumeHierarchy patch_hierarchy;
         
-        unsigned int NODAL_VAO;
-        unsigned int NODAL_VBO;
+        // built by the first nodal interpolation and dropped with the model splines when the knots or degrees change
+        std::unique_ptr<NodalFactorization> nodal_factorization;
         
-        unsigned int KNOT_VAO;
-        unsigned int KNOT_VBO;
+        unsigned int VAO;
+        unsigned int VBO;
+        unsigned int EBO;
+        // position only knot and nodal lines
+        unsigned int line_VAO;
+        unsigned int line_VBO;
+        unsigned int line_EBO;
         
         std::shared_ptr<BSpline> model_u;
         std::shared_ptr<BSpline> model_v;
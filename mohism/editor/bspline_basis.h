@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <assert.h>
+
+// upper bound of the degree handled by the span-local evaluator, basis scratch lives on the stack
+#define MAX_BSPLINE_DEGREE 15
+
+namespace MH
+{
+    // the degree + 1 non zero blending values N(span - degree, degree) ... N(span, degree) at t, triangular de Boor scheme
+    inline void compute_basis_funcs(const float* knots, int span, int degree, float t, float* basis)
+    {
+        assert(degree >= 0 && degree <= MAX_BSPLINE_DEGREE);
+
+        float left[MAX_BSPLINE_DEGREE + 1];
+        float right[MAX_BSPLINE_DEGREE + 1];
+
+        basis[0] = 1.0f;
+        for(int j = 1; j <= degree; j++)
+        {
+            left[j] = t - knots[span + 1 - j];
+            right[j] = knots[span + j] - t;
+
+            float saved = 0.0f;
+            for(int r = 0; r < j; r++)
+            {
+                float temp = basis[r] / (right[r + 1] + left[j - r]);
+                basis[r] = saved + right[r + 1] * temp;
+                saved = left[j - r] * temp;
+            }
+            basis[j] = saved;
+        }
+    }
+
+    // blending values and their first derivatives, N'(i, p) = p * (N(i, p - 1) / (t(i + p) - t(i)) - N(i + 1, p - 1) / (t(i + p + 1) - t(i + 1)))
+    inline void compute_basis_funcs_derivs(const float* knots, int span, int degree, float t, float* basis, float* derivs)
+    {
+        if(degree == 0)
+        {
+            basis[0] = 1.0f;
+            derivs[0] = 0.0f;
+            return;
+        }
+
+        // degree - 1 blending values N(span - degree + 1, degree - 1) ... N(span, degree - 1)
+        float lower[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs(knots, span, degree - 1, t, lower);
+
+        for(int r = 0; r <= degree; r++)
+        {
+            int i = span - degree + r;
+            float derivative = 0.0f;
+            if(r >= 1)
+            {
+                derivative += lower[r - 1] / (knots[i + degree] - knots[i]);
+            }
+            if(r < degree)
+            {
+                derivative -= lower[r] / (knots[i + degree + 1] - knots[i + 1]);
+            }
+            derivs[r] = degree * derivative;
+        }
+
+        compute_basis_funcs(knots, span, degree, t, basis);
+    }
+
+    // blending values with first and second derivatives, the derivative formula above applied to the degree - 1 derivatives
+    inline void compute_basis_funcs_second_derivs(const float* knots, int span, int degree, float t, float* basis, float* derivs, float* second_derivs)
+    {
+        if(degree == 0)
+        {
+            basis[0] = 1.0f;
+            derivs[0] = 0.0f;
+            second_derivs[0] = 0.0f;
+            return;
+        }
+
+        float lower[MAX_BSPLINE_DEGREE + 1];
+        float lower_derivs[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs_derivs(knots, span, degree - 1, t, lower, lower_derivs);
+
+        for(int r = 0; r <= degree; r++)
+        {
+            int i = span - degree + r;
+            float derivative = 0.0f;
+            float second_derivative = 0.0f;
+            if(r >= 1)
+            {
+                derivative += lower[r - 1] / (knots[i + degree] - knots[i]);
+                second_derivative += lower_derivs[r - 1] / (knots[i + degree] - knots[i]);
+            }
+            if(r < degree)
+            {
+                derivative -= lower[r] / (knots[i + degree + 1] - knots[i + 1]);
+                second_derivative -= lower_derivs[r] / (knots[i + degree + 1] - knots[i + 1]);
+            }
+            derivs[r] = degree * derivative;
+            second_derivs[r] = degree * second_derivative;
+        }
+
+        compute_basis_funcs(knots, span, degree, t, basis);
+    }
+
+    // distinct values of a knot vector with their multiplicities, span lookups search these breakpoints instead of every knot
+    class KnotBreakpoints
+    {
+    public:
+        void build(const float* knots, int knot_count, int degree)
+        {
+            values.clear();
+            multiplicities.clear();
+            span_starts.clear();
+
+            int n = knot_count - degree - 2;
+            assert(n >= degree);
+
+            for(int i = 0; i < knot_count; i++)
+            {
+                if(values.empty() || knots[i] != values.back())
+                {
+                    values.push_back(knots[i]);
+                    multiplicities.push_back(1);
+                    span_starts.push_back(i);
+                }
+                else
+                {
+                    multiplicities.back()++;
+                    span_starts.back() = i;
+                }
+
+                if(i == degree)
+                {
+                    domain_first = values.size() - 1;
+                }
+                if(i == n + 1)
+                {
+                    domain_last = values.size() - 1;
+                }
+            }
+
+            // t(k) == t(n + 1), the curve is degenerate, keep lookups inside the knot vector
+            if(domain_last == domain_first)
+            {
+                span_starts[domain_first] = std::min(span_starts[domain_first], n);
+                if(domain_first + 1 == (int)values.size())
+                {
+                    values.push_back(values.back());
+                    multiplicities.push_back(0);
+                    span_starts.push_back(n);
+                }
+                domain_last = domain_first + 1;
+            }
+        }
+
+        // breakpoint b with values[b] <= t < values[b + 1], clamped into the domain
+        int find_interval(float t) const
+        {
+            return std::upper_bound(values.begin() + domain_first + 1, values.begin() + domain_last, t) - values.begin() - 1;
+        }
+
+        int find_span(float t) const
+        {
+            return span_starts[find_interval(t)];
+        }
+
+        // hint keeps the breakpoint of the previous lookup, monotone parameter sequences resolve in O(1)
+        int find_span(float t, int& hint) const
+        {
+            if(hint >= domain_first && hint < domain_last)
+            {
+                if(t >= values[hint] && t < values[hint + 1])
+                {
+                    return span_starts[hint];
+                }
+                if(hint + 1 < domain_last && t >= values[hint + 1] && (hint + 2 == domain_last || t < values[hint + 2]))
+                {
+                    hint++;
+                    return span_starts[hint];
+                }
+            }
+            hint = find_interval(t);
+            return span_starts[hint];
+        }
+
+        // last index i with t(i) < t(i + 1)
+        int get_jmax() const
+        {
+            return values.size() >= 2 ? span_starts[values.size() - 2] : 0;
+        }
+
+        int get_multiplicity(float value) const
+        {
+            auto it = std::lower_bound(values.begin(), values.end(), value);
+            if(it == values.end() || *it != value)
+            {
+                return 0;
+            }
+            return multiplicities[it - values.begin()];
+        }
+
+        std::vector<float> values;
+        std::vector<int> multiplicities;
+        // span_starts[b] is the knot span [values[b], values[b + 1]), the last knot index holding values[b]
+        std::vector<int> span_starts;
+
+    private:
+        // breakpoints of t(k) and t(n + 1)
+        int domain_first = 0;
+        int domain_last = 1;
+    };
+} // namespace MH
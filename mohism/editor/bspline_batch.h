@@ -0,0 +1,262 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "bspline_basis.h"
+#include "bspline_kernel.h"
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define MH_BATCH_SSE 1
+    #include <immintrin.h>
+    // avx2 kernels are compiled per function with target attributes, so the rest of the build keeps its flags
+    #if defined(__GNUC__) || defined(__clang__)
+        #define MH_BATCH_AVX2 1
+    #endif
+#endif
+
+// parameters are handled in chunks, spans of a chunk are located up front so the kernels stay free of branches and calls
+#define BATCH_CHUNK_SIZE 256
+
+namespace MH
+{
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "batch kernels read control points as packed floats");
+
+    enum class SimdLevel
+    {
+        Scalar = 0,
+        SSE = 1,
+        AVX2 = 2
+    };
+
+    inline SimdLevel detect_simd_level()
+    {
+#if MH_BATCH_AVX2
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            return SimdLevel::AVX2;
+        }
+#endif
+#if MH_BATCH_SSE
+        return SimdLevel::SSE;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+
+    // detected once on first use, can be lowered to compare the kernels
+    inline SimdLevel& batch_simd_level()
+    {
+        static SimdLevel level = detect_simd_level();
+        return level;
+    }
+
+    // kernels: curve positions at params[0 .. count) whose knot spans are spans[0 .. count),
+    // result i goes to x[i * stride], y[i * stride], z[i * stride]
+    inline void evaluate_curve_spans_scalar(const float* knots, int degree, const glm::vec3* points,
+                                            const float* params, const int* spans, size_t count,
+                                            float* x, float* y, float* z, size_t stride)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            glm::vec3 result = evaluate_curve_span(knots, spans[i], degree, points + spans[i] - degree, params[i]);
+
+            x[i * stride] = result.x;
+            y[i * stride] = result.y;
+            z[i * stride] = result.z;
+        }
+    }
+
+#if MH_BATCH_SSE
+    // 4 parameters per iteration, every lane runs the triangular scheme on its own span
+    inline void evaluate_curve_spans_sse(const float* knots, int degree, const glm::vec3* points,
+                                         const float* params, const int* spans, size_t count,
+                                         float* x, float* y, float* z, size_t stride)
+    {
+        __m128 basis[MAX_BSPLINE_DEGREE + 1];
+        __m128 left[MAX_BSPLINE_DEGREE + 1];
+        __m128 right[MAX_BSPLINE_DEGREE + 1];
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4)
+        {
+            int s0 = spans[i + 0];
+            int s1 = spans[i + 1];
+            int s2 = spans[i + 2];
+            int s3 = spans[i + 3];
+
+            __m128 t = _mm_loadu_ps(params + i);
+
+            basis[0] = _mm_set1_ps(1.0f);
+            for(int j = 1; j <= degree; j++)
+            {
+                left[j] = _mm_sub_ps(t, _mm_setr_ps(knots[s0 + 1 - j], knots[s1 + 1 - j], knots[s2 + 1 - j], knots[s3 + 1 - j]));
+                right[j] = _mm_sub_ps(_mm_setr_ps(knots[s0 + j], knots[s1 + j], knots[s2 + j], knots[s3 + j]), t);
+
+                __m128 saved = _mm_setzero_ps();
+                for(int r = 0; r < j; r++)
+                {
+                    __m128 temp = _mm_div_ps(basis[r], _mm_add_ps(right[r + 1], left[j - r]));
+                    basis[r] = _mm_add_ps(saved, _mm_mul_ps(right[r + 1], temp));
+                    saved = _mm_mul_ps(left[j - r], temp);
+                }
+                basis[j] = saved;
+            }
+
+            __m128 px = _mm_setzero_ps();
+            __m128 py = _mm_setzero_ps();
+            __m128 pz = _mm_setzero_ps();
+            for(int r = 0; r <= degree; r++)
+            {
+                const glm::vec3& p0 = points[s0 - degree + r];
+                const glm::vec3& p1 = points[s1 - degree + r];
+                const glm::vec3& p2 = points[s2 - degree + r];
+                const glm::vec3& p3 = points[s3 - degree + r];
+                px = _mm_add_ps(px, _mm_mul_ps(basis[r], _mm_setr_ps(p0.x, p1.x, p2.x, p3.x)));
+                py = _mm_add_ps(py, _mm_mul_ps(basis[r], _mm_setr_ps(p0.y, p1.y, p2.y, p3.y)));
+                pz = _mm_add_ps(pz, _mm_mul_ps(basis[r], _mm_setr_ps(p0.z, p1.z, p2.z, p3.z)));
+            }
+
+            if(stride == 1)
+            {
+                _mm_storeu_ps(x + i, px);
+                _mm_storeu_ps(y + i, py);
+                _mm_storeu_ps(z + i, pz);
+            }
+            else
+            {
+                float lanes[3][4];
+                _mm_storeu_ps(lanes[0], px);
+                _mm_storeu_ps(lanes[1], py);
+                _mm_storeu_ps(lanes[2], pz);
+                for(int l = 0; l < 4; l++)
+                {
+                    x[(i + l) * stride] = lanes[0][l];
+                    y[(i + l) * stride] = lanes[1][l];
+                    z[(i + l) * stride] = lanes[2][l];
+                }
+            }
+        }
+
+        evaluate_curve_spans_scalar(knots, degree, points, params + i, spans + i, count - i,
+                                    x + i * stride, y + i * stride, z + i * stride, stride);
+    }
+#endif
+
+#if MH_BATCH_AVX2
+    // 8 parameters per iteration, knots and control points are fetched with hardware gathers
+    __attribute__((target("avx2,fma")))
+    inline void evaluate_curve_spans_avx2(const float* knots, int degree, const glm::vec3* points,
+                                          const float* params, const int* spans, size_t count,
+                                          float* x, float* y, float* z, size_t stride)
+    {
+        __m256 basis[MAX_BSPLINE_DEGREE + 1];
+        __m256 left[MAX_BSPLINE_DEGREE + 1];
+        __m256 right[MAX_BSPLINE_DEGREE + 1];
+
+        const float* coords = &points[0].x;
+        const __m256i three = _mm256_set1_epi32(3);
+
+        size_t i = 0;
+        for(; i + 8 <= count; i += 8)
+        {
+            __m256i span = _mm256_loadu_si256((const __m256i*)(spans + i));
+
+            __m256 t = _mm256_loadu_ps(params + i);
+
+            basis[0] = _mm256_set1_ps(1.0f);
+            for(int j = 1; j <= degree; j++)
+            {
+                __m256 left_knot = _mm256_i32gather_ps(knots, _mm256_add_epi32(span, _mm256_set1_epi32(1 - j)), 4);
+                __m256 right_knot = _mm256_i32gather_ps(knots, _mm256_add_epi32(span, _mm256_set1_epi32(j)), 4);
+                left[j] = _mm256_sub_ps(t, left_knot);
+                right[j] = _mm256_sub_ps(right_knot, t);
+
+                __m256 saved = _mm256_setzero_ps();
+                for(int r = 0; r < j; r++)
+                {
+                    __m256 temp = _mm256_div_ps(basis[r], _mm256_add_ps(right[r + 1], left[j - r]));
+                    basis[r] = _mm256_fmadd_ps(right[r + 1], temp, saved);
+                    saved = _mm256_mul_ps(left[j - r], temp);
+                }
+                basis[j] = saved;
+            }
+
+            __m256 px = _mm256_setzero_ps();
+            __m256 py = _mm256_setzero_ps();
+            __m256 pz = _mm256_setzero_ps();
+            for(int r = 0; r <= degree; r++)
+            {
+                __m256i index = _mm256_mullo_epi32(_mm256_add_epi32(span, _mm256_set1_epi32(r - degree)), three);
+                px = _mm256_fmadd_ps(basis[r], _mm256_i32gather_ps(coords + 0, index, 4), px);
+                py = _mm256_fmadd_ps(basis[r], _mm256_i32gather_ps(coords + 1, index, 4), py);
+                pz = _mm256_fmadd_ps(basis[r], _mm256_i32gather_ps(coords + 2, index, 4), pz);
+            }
+
+            if(stride == 1)
+            {
+                _mm256_storeu_ps(x + i, px);
+                _mm256_storeu_ps(y + i, py);
+                _mm256_storeu_ps(z + i, pz);
+            }
+            else
+            {
+                float lanes[3][8];
+                _mm256_storeu_ps(lanes[0], px);
+                _mm256_storeu_ps(lanes[1], py);
+                _mm256_storeu_ps(lanes[2], pz);
+                for(int l = 0; l < 8; l++)
+                {
+                    x[(i + l) * stride] = lanes[0][l];
+                    y[(i + l) * stride] = lanes[1][l];
+                    z[(i + l) * stride] = lanes[2][l];
+                }
+            }
+        }
+
+        evaluate_curve_spans_scalar(knots, degree, points, params + i, spans + i, count - i,
+                                    x + i * stride, y + i * stride, z + i * stride, stride);
+    }
+#endif
+
+    // curve positions at params[0 .. count), result i goes to x[i * stride], y[i * stride], z[i * stride]
+    // knots must hold count of points + degree + 1 values, breakpoints built from them
+    inline void evaluate_curve_batch(const KnotBreakpoints& breakpoints, const float* knots, int degree, const glm::vec3* points,
+                                     const float* params, size_t count,
+                                     float* x, float* y, float* z, size_t stride)
+    {
+        SimdLevel level = batch_simd_level();
+
+        int spans[BATCH_CHUNK_SIZE];
+        int hint = -1;
+        for(size_t begin = 0; begin < count; begin += BATCH_CHUNK_SIZE)
+        {
+            size_t chunk = std::min((size_t)BATCH_CHUNK_SIZE, count - begin);
+            for(size_t i = 0; i < chunk; i++)
+            {
+                spans[i] = breakpoints.find_span(params[begin + i], hint);
+            }
+
+            const float* chunk_params = params + begin;
+            float* chunk_x = x + begin * stride;
+            float* chunk_y = y + begin * stride;
+            float* chunk_z = z + begin * stride;
+
+            switch(level)
+            {
+#if MH_BATCH_AVX2
+                case SimdLevel::AVX2:
+                    evaluate_curve_spans_avx2(knots, degree, points, chunk_params, spans, chunk, chunk_x, chunk_y, chunk_z, stride);
+                    break;
+#endif
+#if MH_BATCH_SSE
+                case SimdLevel::SSE:
+                    evaluate_curve_spans_sse(knots, degree, points, chunk_params, spans, chunk, chunk_x, chunk_y, chunk_z, stride);
+                    break;
+#endif
+                default:
+                    evaluate_curve_spans_scalar(knots, degree, points, chunk_params, spans, chunk, chunk_x, chunk_y, chunk_z, stride);
+                    break;
+            }
+        }
+    }
+} // namespace MH
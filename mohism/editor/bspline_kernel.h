@@ -0,0 +1,430 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "bspline_basis.h"
+
+// loops below have compile time trip counts, ask for complete unrolling so the basis stays in registers
+#if defined(__clang__) || defined(__GNUC__)
+    #define MH_UNROLL _Pragma("GCC unroll 16")
+#else
+    #define MH_UNROLL
+#endif
+
+namespace MH
+{
+    // triangular scheme with a compile time degree, degrees 1 ... 5 are specialized and higher degrees take the generic path
+    template<int Degree>
+    inline void basis_funcs_fixed(const float* knots, int span, float t, float* basis)
+    {
+        static_assert(Degree >= 1 && Degree <= MAX_BSPLINE_DEGREE, "degree out of range");
+
+        float left[Degree + 1];
+        float right[Degree + 1];
+
+        basis[0] = 1.0f;
+        MH_UNROLL
+        for(int j = 1; j <= Degree; j++)
+        {
+            left[j] = t - knots[span + 1 - j];
+            right[j] = knots[span + j] - t;
+
+            float saved = 0.0f;
+            MH_UNROLL
+            for(int r = 0; r < j; r++)
+            {
+                float temp = basis[r] / (right[r + 1] + left[j - r]);
+                basis[r] = saved + right[r + 1] * temp;
+                saved = left[j - r] * temp;
+            }
+            basis[j] = saved;
+        }
+    }
+
+    // blending values and first derivatives, the derivative is taken from the degree - 1 row of the same triangle
+    template<int Degree>
+    inline void basis_funcs_derivs_fixed(const float* knots, int span, float t, float* basis, float* derivs)
+    {
+        static_assert(Degree >= 1 && Degree <= MAX_BSPLINE_DEGREE, "degree out of range");
+
+        float left[Degree + 1];
+        float right[Degree + 1];
+
+        basis[0] = 1.0f;
+        MH_UNROLL
+        for(int j = 1; j <= Degree; j++)
+        {
+            left[j] = t - knots[span + 1 - j];
+            right[j] = knots[span + j] - t;
+
+            if(j == Degree)
+            {
+                MH_UNROLL
+                for(int r = 0; r <= Degree; r++)
+                {
+                    int i = span - Degree + r;
+                    float derivative = 0.0f;
+                    if(r >= 1)
+                    {
+                        derivative += basis[r - 1] / (knots[i + Degree] - knots[i]);
+                    }
+                    if(r < Degree)
+                    {
+                        derivative -= basis[r] / (knots[i + Degree + 1] - knots[i + 1]);
+                    }
+                    derivs[r] = Degree * derivative;
+                }
+            }
+
+            float saved = 0.0f;
+            MH_UNROLL
+            for(int r = 0; r < j; r++)
+            {
+                float temp = basis[r] / (right[r + 1] + left[j - r]);
+                basis[r] = saved + right[r + 1] * temp;
+                saved = left[j - r] * temp;
+            }
+            basis[j] = saved;
+        }
+    }
+
+    // curve kernels, points is P(span - degree), the first of the degree + 1 control points of the span
+
+    template<int Degree>
+    inline glm::vec3 evaluate_curve_span_fixed(const float* knots, int span, const glm::vec3* points, float t)
+    {
+        float basis[Degree + 1];
+        basis_funcs_fixed<Degree>(knots, span, t, basis);
+
+        glm::vec3 result = basis[0] * points[0];
+        MH_UNROLL
+        for(int r = 1; r <= Degree; r++)
+        {
+            result += basis[r] * points[r];
+        }
+        return result;
+    }
+
+    template<int Degree>
+    inline void evaluate_curve_derivative_span_fixed(const float* knots, int span, const glm::vec3* points, float t,
+                                                     glm::vec3& position, glm::vec3& derivative)
+    {
+        float basis[Degree + 1];
+        float derivs[Degree + 1];
+        basis_funcs_derivs_fixed<Degree>(knots, span, t, basis, derivs);
+
+        position = basis[0] * points[0];
+        derivative = derivs[0] * points[0];
+        MH_UNROLL
+        for(int r = 1; r <= Degree; r++)
+        {
+            position += basis[r] * points[r];
+            derivative += derivs[r] * points[r];
+        }
+    }
+
+    inline glm::vec3 evaluate_curve_span_generic(const float* knots, int span, int degree, const glm::vec3* points, float t)
+    {
+        float basis[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs(knots, span, degree, t, basis);
+
+        glm::vec3 result(0.0f, 0.0f, 0.0f);
+        for(int r = 0; r <= degree; r++)
+        {
+            result += basis[r] * points[r];
+        }
+        return result;
+    }
+
+    inline void evaluate_curve_derivative_span_generic(const float* knots, int span, int degree, const glm::vec3* points, float t,
+                                                       glm::vec3& position, glm::vec3& derivative)
+    {
+        float basis[MAX_BSPLINE_DEGREE + 1];
+        float derivs[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs_derivs(knots, span, degree, t, basis, derivs);
+
+        position = glm::vec3(0.0f, 0.0f, 0.0f);
+        derivative = glm::vec3(0.0f, 0.0f, 0.0f);
+        for(int r = 0; r <= degree; r++)
+        {
+            position += basis[r] * points[r];
+            derivative += derivs[r] * points[r];
+        }
+    }
+
+    inline glm::vec3 evaluate_curve_span(const float* knots, int span, int degree, const glm::vec3* points, float t)
+    {
+        switch(degree)
+        {
+            case 1: return evaluate_curve_span_fixed<1>(knots, span, points, t);
+            case 2: return evaluate_curve_span_fixed<2>(knots, span, points, t);
+            case 3: return evaluate_curve_span_fixed<3>(knots, span, points, t);
+            case 4: return evaluate_curve_span_fixed<4>(knots, span, points, t);
+            case 5: return evaluate_curve_span_fixed<5>(knots, span, points, t);
+            default: return evaluate_curve_span_generic(knots, span, degree, points, t);
+        }
+    }
+
+    inline void evaluate_curve_derivative_span(const float* knots, int span, int degree, const glm::vec3* points, float t,
+                                               glm::vec3& position, glm::vec3& derivative)
+    {
+        switch(degree)
+        {
+            case 1: evaluate_curve_derivative_span_fixed<1>(knots, span, points, t, position, derivative); return;
+            case 2: evaluate_curve_derivative_span_fixed<2>(knots, span, points, t, position, derivative); return;
+            case 3: evaluate_curve_derivative_span_fixed<3>(knots, span, points, t, position, derivative); return;
+            case 4: evaluate_curve_derivative_span_fixed<4>(knots, span, points, t, position, derivative); return;
+            case 5: evaluate_curve_derivative_span_fixed<5>(knots, span, points, t, position, derivative); return;
+            default: evaluate_curve_derivative_span_generic(knots, span, degree, points, t, position, derivative); return;
+        }
+    }
+
+    // rational tensor product surface kernels, points is P(span_u - degree_u, span_v - degree_v) of a row major net
+    // with width points per row, xyz are cartesian coordinates and w the weight
+
+    template<int DegreeU, int DegreeV>
+    inline glm::vec3 evaluate_surface_span_fixed(const float* knots_u, int span_u, float u,
+                                                 const float* knots_v, int span_v, float v,
+                                                 const glm::vec4* points, int width)
+    {
+        float basis_u[DegreeU + 1];
+        float basis_v[DegreeV + 1];
+        basis_funcs_fixed<DegreeU>(knots_u, span_u, u, basis_u);
+        basis_funcs_fixed<DegreeV>(knots_v, span_v, v, basis_v);
+
+        glm::vec3 top(0.0f, 0.0f, 0.0f);
+        float bottom = 0.0f;
+        MH_UNROLL
+        for(int i = 0; i <= DegreeU; i++)
+        {
+            const glm::vec4* row = points + i * width;
+            MH_UNROLL
+            for(int j = 0; j <= DegreeV; j++)
+            {
+                float weight = basis_u[i] * basis_v[j] * row[j].w;
+                top += weight * glm::vec3(row[j]);
+                bottom += weight;
+            }
+        }
+        return top / bottom;
+    }
+
+    // position and the partial derivatives along u and v, quotient rule on the homogeneous sums
+    template<int DegreeU, int DegreeV>
+    inline void evaluate_surface_derivative_span_fixed(const float* knots_u, int span_u, float u,
+                                                       const float* knots_v, int span_v, float v,
+                                                       const glm::vec4* points, int width,
+                                                       glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v)
+    {
+        float basis_u[DegreeU + 1];
+        float derivs_u[DegreeU + 1];
+        float basis_v[DegreeV + 1];
+        float derivs_v[DegreeV + 1];
+        basis_funcs_derivs_fixed<DegreeU>(knots_u, span_u, u, basis_u, derivs_u);
+        basis_funcs_derivs_fixed<DegreeV>(knots_v, span_v, v, basis_v, derivs_v);
+
+        glm::vec3 top(0.0f, 0.0f, 0.0f);
+        glm::vec3 top_u(0.0f, 0.0f, 0.0f);
+        glm::vec3 top_v(0.0f, 0.0f, 0.0f);
+        float bottom = 0.0f;
+        float bottom_u = 0.0f;
+        float bottom_v = 0.0f;
+        MH_UNROLL
+        for(int i = 0; i <= DegreeU; i++)
+        {
+            const glm::vec4* row = points + i * width;
+            MH_UNROLL
+            for(int j = 0; j <= DegreeV; j++)
+            {
+                glm::vec3 point = glm::vec3(row[j]) * row[j].w;
+                float w = row[j].w;
+                top += (basis_u[i] * basis_v[j]) * point;
+                top_u += (derivs_u[i] * basis_v[j]) * point;
+                top_v += (basis_u[i] * derivs_v[j]) * point;
+                bottom += basis_u[i] * basis_v[j] * w;
+                bottom_u += derivs_u[i] * basis_v[j] * w;
+                bottom_v += basis_u[i] * derivs_v[j] * w;
+            }
+        }
+
+        position = top / bottom;
+        derivative_u = (top_u - bottom_u * position) / bottom;
+        derivative_v = (top_v - bottom_v * position) / bottom;
+    }
+
+    inline glm::vec3 evaluate_surface_span_generic(const float* knots_u, int span_u, int degree_u, float u,
+                                                   const float* knots_v, int span_v, int degree_v, float v,
+                                                   const glm::vec4* points, int width)
+    {
+        float basis_u[MAX_BSPLINE_DEGREE + 1];
+        float basis_v[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs(knots_u, span_u, degree_u, u, basis_u);
+        compute_basis_funcs(knots_v, span_v, degree_v, v, basis_v);
+
+        glm::vec3 top(0.0f, 0.0f, 0.0f);
+        float bottom = 0.0f;
+        for(int i = 0; i <= degree_u; i++)
+        {
+            const glm::vec4* row = points + i * width;
+            for(int j = 0; j <= degree_v; j++)
+            {
+                float weight = basis_u[i] * basis_v[j] * row[j].w;
+                top += weight * glm::vec3(row[j]);
+                bottom += weight;
+            }
+        }
+        return top / bottom;
+    }
+
+    inline void evaluate_surface_derivative_span_generic(const float* knots_u, int span_u, int degree_u, float u,
+                                                         const float* knots_v, int span_v, int degree_v, float v,
+                                                         const glm::vec4* points, int width,
+                                                         glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v)
+    {
+        float basis_u[MAX_BSPLINE_DEGREE + 1];
+        float derivs_u[MAX_BSPLINE_DEGREE + 1];
+        float basis_v[MAX_BSPLINE_DEGREE + 1];
+        float derivs_v[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs_derivs(knots_u, span_u, degree_u, u, basis_u, derivs_u);
+        compute_basis_funcs_derivs(knots_v, span_v, degree_v, v, basis_v, derivs_v);
+
+        glm::vec3 top(0.0f, 0.0f, 0.0f);
+        glm::vec3 top_u(0.0f, 0.0f, 0.0f);
+        glm::vec3 top_v(0.0f, 0.0f, 0.0f);
+        float bottom = 0.0f;
+        float bottom_u = 0.0f;
+        float bottom_v = 0.0f;
+        for(int i = 0; i <= degree_u; i++)
+        {
+            const glm::vec4* row = points + i * width;
+            for(int j = 0; j <= degree_v; j++)
+            {
+                glm::vec3 point = glm::vec3(row[j]) * row[j].w;
+                float w = row[j].w;
+                top += (basis_u[i] * basis_v[j]) * point;
+                top_u += (derivs_u[i] * basis_v[j]) * point;
+                top_v += (basis_u[i] * derivs_v[j]) * point;
+                bottom += basis_u[i] * basis_v[j] * w;
+                bottom_u += derivs_u[i] * basis_v[j] * w;
+                bottom_v += basis_u[i] * derivs_v[j] * w;
+            }
+        }
+
+        position = top / bottom;
+        derivative_u = (top_u - bottom_u * position) / bottom;
+        derivative_v = (top_v - bottom_v * position) / bottom;
+    }
+
+    // position, first partials and the second partials uu, uv, vv, generic only as it is needed per projection step
+    // rather than per sample, second quotient rule on the homogeneous sums
+    inline void evaluate_surface_second_derivative_span(const float* knots_u, int span_u, int degree_u, float u,
+                                                        const float* knots_v, int span_v, int degree_v, float v,
+                                                        const glm::vec4* points, int width,
+                                                        glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v,
+                                                        glm::vec3& derivative_uu, glm::vec3& derivative_uv, glm::vec3& derivative_vv)
+    {
+        float basis_u[MAX_BSPLINE_DEGREE + 1];
+        float derivs_u[MAX_BSPLINE_DEGREE + 1];
+        float second_derivs_u[MAX_BSPLINE_DEGREE + 1];
+        float basis_v[MAX_BSPLINE_DEGREE + 1];
+        float derivs_v[MAX_BSPLINE_DEGREE + 1];
+        float second_derivs_v[MAX_BSPLINE_DEGREE + 1];
+        compute_basis_funcs_second_derivs(knots_u, span_u, degree_u, u, basis_u, derivs_u, second_derivs_u);
+        compute_basis_funcs_second_derivs(knots_v, span_v, degree_v, v, basis_v, derivs_v, second_derivs_v);
+
+        // homogeneous sums, xyz weighted, w the weight
+        glm::vec4 top(0.0f);
+        glm::vec4 top_u(0.0f);
+        glm::vec4 top_v(0.0f);
+        glm::vec4 top_uu(0.0f);
+        glm::vec4 top_uv(0.0f);
+        glm::vec4 top_vv(0.0f);
+        for(int i = 0; i <= degree_u; i++)
+        {
+            const glm::vec4* row = points + i * width;
+            for(int j = 0; j <= degree_v; j++)
+            {
+                glm::vec4 point(glm::vec3(row[j]) * row[j].w, row[j].w);
+                top += (basis_u[i] * basis_v[j]) * point;
+                top_u += (derivs_u[i] * basis_v[j]) * point;
+                top_v += (basis_u[i] * derivs_v[j]) * point;
+                top_uu += (second_derivs_u[i] * basis_v[j]) * point;
+                top_uv += (derivs_u[i] * derivs_v[j]) * point;
+                top_vv += (basis_u[i] * second_derivs_v[j]) * point;
+            }
+        }
+
+        float w = top.w;
+        position = glm::vec3(top) / w;
+        derivative_u = (glm::vec3(top_u) - top_u.w * position) / w;
+        derivative_v = (glm::vec3(top_v) - top_v.w * position) / w;
+        derivative_uu = (glm::vec3(top_uu) - 2.0f * top_u.w * derivative_u - top_uu.w * position) / w;
+        derivative_uv = (glm::vec3(top_uv) - top_u.w * derivative_v - top_v.w * derivative_u - top_uv.w * position) / w;
+        derivative_vv = (glm::vec3(top_vv) - 2.0f * top_v.w * derivative_v - top_vv.w * position) / w;
+    }
+
+    // second level of the surface dispatch, DegreeU is already fixed
+    template<int DegreeU>
+    inline glm::vec3 evaluate_surface_span_by_v(const float* knots_u, int span_u, float u,
+                                                const float* knots_v, int span_v, int degree_v, float v,
+                                                const glm::vec4* points, int width)
+    {
+        switch(degree_v)
+        {
+            case 1: return evaluate_surface_span_fixed<DegreeU, 1>(knots_u, span_u, u, knots_v, span_v, v, points, width);
+            case 2: return evaluate_surface_span_fixed<DegreeU, 2>(knots_u, span_u, u, knots_v, span_v, v, points, width);
+            case 3: return evaluate_surface_span_fixed<DegreeU, 3>(knots_u, span_u, u, knots_v, span_v, v, points, width);
+            case 4: return evaluate_surface_span_fixed<DegreeU, 4>(knots_u, span_u, u, knots_v, span_v, v, points, width);
+            case 5: return evaluate_surface_span_fixed<DegreeU, 5>(knots_u, span_u, u, knots_v, span_v, v, points, width);
+            default: return evaluate_surface_span_generic(knots_u, span_u, DegreeU, u, knots_v, span_v, degree_v, v, points, width);
+        }
+    }
+
+    template<int DegreeU>
+    inline void evaluate_surface_derivative_span_by_v(const float* knots_u, int span_u, float u,
+                                                      const float* knots_v, int span_v, int degree_v, float v,
+                                                      const glm::vec4* points, int width,
+                                                      glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v)
+    {
+        switch(degree_v)
+        {
+            case 1: evaluate_surface_derivative_span_fixed<DegreeU, 1>(knots_u, span_u, u, knots_v, span_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 2: evaluate_surface_derivative_span_fixed<DegreeU, 2>(knots_u, span_u, u, knots_v, span_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 3: evaluate_surface_derivative_span_fixed<DegreeU, 3>(knots_u, span_u, u, knots_v, span_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 4: evaluate_surface_derivative_span_fixed<DegreeU, 4>(knots_u, span_u, u, knots_v, span_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 5: evaluate_surface_derivative_span_fixed<DegreeU, 5>(knots_u, span_u, u, knots_v, span_v, v, points, width, position, derivative_u, derivative_v); return;
+            default: evaluate_surface_derivative_span_generic(knots_u, span_u, DegreeU, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+        }
+    }
+
+    inline glm::vec3 evaluate_surface_span(const float* knots_u, int span_u, int degree_u, float u,
+                                           const float* knots_v, int span_v, int degree_v, float v,
+                                           const glm::vec4* points, int width)
+    {
+        switch(degree_u)
+        {
+            case 1: return evaluate_surface_span_by_v<1>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width);
+            case 2: return evaluate_surface_span_by_v<2>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width);
+            case 3: return evaluate_surface_span_by_v<3>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width);
+            case 4: return evaluate_surface_span_by_v<4>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width);
+            case 5: return evaluate_surface_span_by_v<5>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width);
+            default: return evaluate_surface_span_generic(knots_u, span_u, degree_u, u, knots_v, span_v, degree_v, v, points, width);
+        }
+    }
+
+    inline void evaluate_surface_derivative_span(const float* knots_u, int span_u, int degree_u, float u,
+                                                 const float* knots_v, int span_v, int degree_v, float v,
+                                                 const glm::vec4* points, int width,
+                                                 glm::vec3& position, glm::vec3& derivative_u, glm::vec3& derivative_v)
+    {
+        switch(degree_u)
+        {
+            case 1: evaluate_surface_derivative_span_by_v<1>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 2: evaluate_surface_derivative_span_by_v<2>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 3: evaluate_surface_derivative_span_by_v<3>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 4: evaluate_surface_derivative_span_by_v<4>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+            case 5: evaluate_surface_derivative_span_by_v<5>(knots_u, span_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+            default: evaluate_surface_derivative_span_generic(knots_u, span_u, degree_u, u, knots_v, span_v, degree_v, v, points, width, position, derivative_u, derivative_v); return;
+        }
+    }
+} // namespace MH
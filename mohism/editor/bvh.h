@@ -0,0 +1,275 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// items per leaf of the hierarchy
+#define BVH_LEAF_SIZE 2
+
+namespace MH
+{
+    // slab test of origin + t * direction for t in [0, limit], entry is where the ray enters the box, 0 from inside
+    inline bool intersect_ray_box(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inverse_direction,
+                                  float limit, float& entry)
+    {
+        entry = 0.0f;
+        float exit = limit;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            // parallel to the slab, 0 * inf on its plane would be nan, the ray is inside it everywhere or nowhere
+            if(std::isinf(inverse_direction[axis]))
+            {
+                if(origin[axis] < min[axis] || origin[axis] > max[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            float t0 = (min[axis] - origin[axis]) * inverse_direction[axis];
+            float t1 = (max[axis] - origin[axis]) * inverse_direction[axis];
+            entry = std::max(entry, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        return entry <= exit;
+    }
+
+    // bounding volume hierarchy over the axis aligned boxes of indexed items, split at the median box center
+    // along the widest axis, nodes are stored depth first so the first child of an inner node follows it
+    class BoundingVolumeHierarchy
+    {
+    public:
+        struct Node
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+            // leaf: items[first .. first + count), inner node: count is 0 and first is the second child
+            int first;
+            int count;
+        };
+
+        // item i is the box mins[i], maxs[i]
+        void build(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs)
+        {
+            nodes.clear();
+            items.resize(mins.size());
+            for(size_t i = 0; i < items.size(); i++)
+            {
+                items[i] = i;
+            }
+            if(items.empty())
+            {
+                return;
+            }
+            nodes.reserve(2 * items.size());
+            build_node(mins, maxs, 0, items.size());
+        }
+
+        bool empty() const
+        {
+            return nodes.empty();
+        }
+
+        // visit(item, best_squared) for the items of every leaf whose box is within sqrt(best_squared) of point,
+        // nearer subtrees first, visit may lower best_squared to prune the rest
+        template<typename Visit>
+        void visit_nearest(const glm::vec3& point, float& best_squared, Visit visit) const
+        {
+            if(nodes.empty())
+            {
+                return;
+            }
+
+            // the tree is balanced, each level leaves at most one node behind on the stack
+            int stack[64];
+            float stack_distance[64];
+            int size = 0;
+            stack[size] = 0;
+            stack_distance[size] = distance_squared(nodes[0], point);
+            size++;
+
+            while(size > 0)
+            {
+                size--;
+                int index = stack[size];
+                if(stack_distance[size] > best_squared)
+                {
+                    continue;
+                }
+
+                const Node& node = nodes[index];
+                if(node.count > 0)
+                {
+                    for(int i = node.first; i < node.first + node.count; i++)
+                    {
+                        visit(items[i], best_squared);
+                    }
+                    continue;
+                }
+
+                int closer = index + 1;
+                int farther = node.first;
+                float closer_distance = distance_squared(nodes[closer], point);
+                float farther_distance = distance_squared(nodes[farther], point);
+                if(farther_distance < closer_distance)
+                {
+                    std::swap(closer, farther);
+                    std::swap(closer_distance, farther_distance);
+                }
+
+                stack[size] = farther;
+                stack_distance[size] = farther_distance;
+                size++;
+                stack[size] = closer;
+                stack_distance[size] = closer_distance;
+                size++;
+            }
+        }
+
+        // visit(item, limit) for the items of every leaf whose box the ray origin + t * direction enters before limit,
+        // nearer boxes first, visit lowers limit when it finds a hit so farther boxes are skipped
+        template<typename Visit>
+        void visit_ray(const glm::vec3& origin, const glm::vec3& direction, float& limit, Visit visit) const
+        {
+            if(nodes.empty())
+            {
+                return;
+            }
+
+            glm::vec3 inverse_direction = 1.0f / direction;
+            float entry;
+            if(!intersect_ray_box(nodes[0].min, nodes[0].max, origin, inverse_direction, limit, entry))
+            {
+                return;
+            }
+
+            int stack[64];
+            float stack_entry[64];
+            int size = 0;
+            stack[size] = 0;
+            stack_entry[size] = entry;
+            size++;
+
+            while(size > 0)
+            {
+                size--;
+                int index = stack[size];
+                if(stack_entry[size] > limit)
+                {
+                    continue;
+                }
+
+                const Node& node = nodes[index];
+                if(node.count > 0)
+                {
+                    for(int i = node.first; i < node.first + node.count; i++)
+                    {
+                        visit(items[i], limit);
+                    }
+                    continue;
+                }
+
+                int closer = index + 1;
+                int farther = node.first;
+                float closer_entry;
+                float farther_entry;
+                bool closer_hit = intersect_ray_box(nodes[closer].min, nodes[closer].max, origin, inverse_direction, limit, closer_entry);
+                bool farther_hit = intersect_ray_box(nodes[farther].min, nodes[farther].max, origin, inverse_direction, limit, farther_entry);
+                if(farther_hit && (!closer_hit || farther_entry < closer_entry))
+                {
+                    std::swap(closer, farther);
+                    std::swap(closer_entry, farther_entry);
+                    std::swap(closer_hit, farther_hit);
+                }
+
+                if(farther_hit)
+                {
+                    stack[size] = farther;
+                    stack_entry[size] = farther_entry;
+                    size++;
+                }
+                if(closer_hit)
+                {
+                    stack[size] = closer;
+                    stack_entry[size] = closer_entry;
+                    size++;
+                }
+            }
+        }
+
+        const std::vector<Node>& get_nodes() const
+        {
+            return nodes;
+        }
+
+        const std::vector<int>& get_items() const
+        {
+            return items;
+        }
+
+    private:
+        static float distance_squared(const Node& node, const glm::vec3& point)
+        {
+            glm::vec3 outside = glm::max(glm::max(node.min - point, point - node.max), glm::vec3(0.0f));
+            return glm::dot(outside, outside);
+        }
+
+        int build_node(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, int begin, int end)
+        {
+            int index = nodes.size();
+            nodes.push_back(Node());
+
+            glm::vec3 min = mins[items[begin]];
+            glm::vec3 max = maxs[items[begin]];
+            glm::vec3 center_min = 0.5f * (min + max);
+            glm::vec3 center_max = center_min;
+            for(int i = begin + 1; i < end; i++)
+            {
+                min = glm::min(min, mins[items[i]]);
+                max = glm::max(max, maxs[items[i]]);
+                glm::vec3 center = 0.5f * (mins[items[i]] + maxs[items[i]]);
+                center_min = glm::min(center_min, center);
+                center_max = glm::max(center_max, center);
+            }
+            nodes[index].min = min;
+            nodes[index].max = max;
+
+            if(end - begin <= BVH_LEAF_SIZE)
+            {
+                nodes[index].first = begin;
+                nodes[index].count = end - begin;
+                return index;
+            }
+
+            glm::vec3 extent = center_max - center_min;
+            int axis = 0;
+            if(extent.y > extent[axis])
+            {
+                axis = 1;
+            }
+            if(extent.z > extent[axis])
+            {
+                axis = 2;
+            }
+
+            int middle = (begin + end) / 2;
+            std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end, [&](int a, int b)
+            {
+                return mins[a][axis] + maxs[a][axis] < mins[b][axis] + maxs[b][axis];
+            });
+
+            build_node(mins, maxs, begin, middle);
+            int second = build_node(mins, maxs, middle, end);
+            nodes[index].first = second;
+            nodes[index].count = 0;
+            return index;
+        }
+
+        std::vector<Node> nodes;
+        // item indices, every leaf owns a contiguous range
+        std::vector<int> items;
+    };
+} // namespace MH
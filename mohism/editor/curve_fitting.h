@@ -0,0 +1,258 @@
+#pragma once
+
+#include "bspline.h"
+#include "matrix.h"
+
+// how data points are spread over [0, 1], spacing proportional to the chord length to the power 1 or 1/2
+#define PARAMETERIZE_UNIFORM 0
+#define PARAMETERIZE_CHORD_LENGTH 1
+#define PARAMETERIZE_CENTRIPETAL 2
+
+namespace MH
+{
+    // parameter of every data point, increasing from 0 to 1, uniform when the points coincide
+    inline void compute_fitting_params(const std::vector<glm::vec3>& points, int parameterization, std::vector<float>& params)
+    {
+        size_t count = points.size();
+        params.resize(count);
+        if(count == 0)
+        {
+            return;
+        }
+
+        std::vector<double> lengths(count, 0.0);
+        double total = 0.0;
+        if(parameterization != PARAMETERIZE_UNIFORM)
+        {
+            for(size_t i = 1; i < count; i++)
+            {
+                double chord = glm::length(points[i] - points[i - 1]);
+                total += parameterization == PARAMETERIZE_CENTRIPETAL ? std::sqrt(chord) : chord;
+                lengths[i] = total;
+            }
+        }
+
+        for(size_t i = 0; i < count; i++)
+        {
+            if(total > 0.0)
+            {
+                params[i] = (float)(lengths[i] / total);
+            }
+            else
+            {
+                params[i] = count > 1 ? (float)i / (float)(count - 1) : 0.0f;
+            }
+        }
+        params.back() = count > 1 ? 1.0f : 0.0f;
+    }
+
+    // clamped knots over [0, 1] for interpolating points at params, every interior knot averages degree consecutive params,
+    // each point then lies inside the support of its own blending function and the collocation matrix is banded and regular
+    inline void compute_interpolation_knots(const std::vector<float>& params, int degree, std::vector<float>& knots)
+    {
+        int n = params.size() - 1;
+        knots.assign(n + degree + 2, 0.0f);
+
+        double sum = 0.0;
+        for(int i = 1; i < degree; i++)
+        {
+            sum += params[i];
+        }
+        for(int j = 1; j <= n - degree; j++)
+        {
+            sum += params[j + degree - 1];
+            knots[j + degree] = (float)(sum / degree);
+            sum -= params[j];
+        }
+        for(int i = n + 1; i <= n + degree + 1; i++)
+        {
+            knots[i] = 1.0f;
+        }
+    }
+
+    // clamped knots over [0, 1] for control_count control points fitted to points at params,
+    // interior knots are interpolated between params so every knot span holds at least one param
+    inline void compute_approximation_knots(const std::vector<float>& params, int control_count, int degree, std::vector<float>& knots)
+    {
+        int n = control_count - 1;
+        int m = params.size() - 1;
+        knots.assign(n + degree + 2, 0.0f);
+
+        double d = (double)(m + 1) / (double)(n - degree + 1);
+        for(int j = 1; j <= n - degree; j++)
+        {
+            int i = (int)(j * d);
+            double alpha = j * d - i;
+            knots[j + degree] = (float)((1.0 - alpha) * params[i - 1] + alpha * params[i]);
+        }
+        for(int i = n + 1; i <= n + degree + 1; i++)
+        {
+            knots[i] = 1.0f;
+        }
+    }
+
+    // clamped curve with knots and control points ready for the editor, knots must be clamped over [0, 1]
+    inline std::shared_ptr<BSpline> make_fitted_curve(int degree, std::vector<float>& knots, std::vector<glm::vec3>& control_points)
+    {
+        auto curve = std::make_shared<BSpline>();
+        curve->set_degree(degree);
+        curve->set_dimension(3);
+        curve->add_knot_vector(knots);
+        curve->add_control_points(control_points);
+        return curve;
+    }
+
+    // curve of the given degree through every point, one control point per data point, the collocation system
+    // N(j)(params[k]) P(j) = points[k] is solved with the banded lu, null when there are too few points
+    inline std::shared_ptr<BSpline> interpolate_curve(const std::vector<glm::vec3>& points, int degree, int parameterization = PARAMETERIZE_CHORD_LENGTH)
+    {
+        int count = points.size();
+        if(degree < 1 || degree > MAX_BSPLINE_DEGREE || count < degree + 1)
+        {
+            return nullptr;
+        }
+
+        std::vector<float> params;
+        std::vector<float> knots;
+        compute_fitting_params(points, parameterization, params);
+        compute_interpolation_knots(params, degree, knots);
+
+        KnotBreakpoints breakpoints;
+        breakpoints.build(knots.data(), knots.size(), degree);
+
+        // row k has its non zero entries in columns span - degree ... span with span in [k, k + degree]
+        BandedLUFactorization collocation;
+        collocation.reset(count, degree, degree);
+        Matrix right(count, 3);
+
+        int hint = -1;
+        float basis[MAX_BSPLINE_DEGREE + 1];
+        for(int k = 0; k < count; k++)
+        {
+            int span = breakpoints.find_span(params[k], hint);
+            compute_basis_funcs(knots.data(), span, degree, params[k], basis);
+            for(int r = 0; r <= degree; r++)
+            {
+                int column = span - degree + r;
+                if(std::abs(column - k) <= degree)
+                {
+                    collocation.at(k, column) = basis[r];
+                }
+            }
+            right(k, 0) = points[k].x;
+            right(k, 1) = points[k].y;
+            right(k, 2) = points[k].z;
+        }
+
+        if(!collocation.factor())
+        {
+            return nullptr;
+        }
+        collocation.solve(right);
+
+        std::vector<glm::vec3> control_points(count);
+        for(int i = 0; i < count; i++)
+        {
+            control_points[i] = glm::vec3(right(i, 0), right(i, 1), right(i, 2));
+        }
+        return make_fitted_curve(degree, knots, control_points);
+    }
+
+    // least squares curve with control_count control points through the first and last point,
+    // the interior control points solve the normal equations N^T N P = N^T R, symmetric positive definite and banded
+    // with degree entries on each side of the diagonal so the banded cholesky needs no pivoting, interpolates when control_count reaches the point count, null when there are too few points
+    inline std::shared_ptr<BSpline> fit_curve(const std::vector<glm::vec3>& points, int control_count, int degree, int parameterization = PARAMETERIZE_CHORD_LENGTH)
+    {
+        int count = points.size();
+        if(control_count >= count)
+        {
+            return interpolate_curve(points, degree, parameterization);
+        }
+        if(degree < 1 || degree > MAX_BSPLINE_DEGREE || control_count < degree + 1 || control_count < 2)
+        {
+            return nullptr;
+        }
+
+        std::vector<float> params;
+        std::vector<float> knots;
+        compute_fitting_params(points, parameterization, params);
+        compute_approximation_knots(params, control_count, degree, knots);
+
+        KnotBreakpoints breakpoints;
+        breakpoints.build(knots.data(), knots.size(), degree);
+
+        int n = control_count - 1;
+        int m = count - 1;
+        glm::dvec3 first = points[0];
+        glm::dvec3 last = points[m];
+
+        std::vector<glm::vec3> control_points(control_count);
+        control_points[0] = points[0];
+        control_points[n] = points[m];
+
+        // unknowns are control points 1 ... n - 1, at row and column j - 1
+        int unknowns = n - 1;
+        if(unknowns > 0)
+        {
+            BandedCholeskyFactorization normal;
+            normal.reset(unknowns, degree);
+            Matrix right(unknowns, 3);
+
+            int hint = -1;
+            float basis[MAX_BSPLINE_DEGREE + 1];
+            for(int k = 1; k < m; k++)
+            {
+                int span = breakpoints.find_span(params[k], hint);
+                compute_basis_funcs(knots.data(), span, degree, params[k], basis);
+
+                // residual of the point after the fixed end control points
+                glm::dvec3 residual = glm::dvec3(points[k]);
+                for(int r = 0; r <= degree; r++)
+                {
+                    int j = span - degree + r;
+                    if(j == 0)
+                    {
+                        residual -= (double)basis[r] * first;
+                    }
+                    else if(j == n)
+                    {
+                        residual -= (double)basis[r] * last;
+                    }
+                }
+
+                for(int r = 0; r <= degree; r++)
+                {
+                    int row = span - degree + r - 1;
+                    if(row < 0 || row >= unknowns)
+                    {
+                        continue;
+                    }
+                    // lower band only, the upper one is its mirror
+                    for(int s = 0; s <= r; s++)
+                    {
+                        int column = span - degree + s - 1;
+                        if(column >= 0)
+                        {
+                            normal.at(row, column) += (double)basis[r] * basis[s];
+                        }
+                    }
+                    right(row, 0) += basis[r] * residual.x;
+                    right(row, 1) += basis[r] * residual.y;
+                    right(row, 2) += basis[r] * residual.z;
+                }
+            }
+
+            if(!normal.factor())
+            {
+                return nullptr;
+            }
+            normal.solve(right);
+
+            for(int j = 1; j < n; j++)
+            {
+                control_points[j] = glm::vec3(right(j - 1, 0), right(j - 1, 1), right(j - 1, 2));
+            }
+        }
+        return make_fitted_curve(degree, knots, control_points);
+    }
+} // namespace MH
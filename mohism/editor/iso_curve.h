@@ -0,0 +1,131 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "bspline_basis.h"
+#include "bspline_kernel.h"
+#include "bspline_batch.h"
+#include <vector>
+
+namespace MH
+{
+    // rational b-spline curve cut out of a surface at a constant parameter,
+    // control points are homogeneous (w * x, w * y, w * z, w), no render state,
+    // samples go through the batch kernels on the numerator and, unless every weight is 1, divide by the scalar weight curve
+    class IsoCurve
+    {
+    public:
+        IsoCurve(int _degree, std::vector<float> _knots, std::vector<glm::vec4> _control_points)
+        : degree(_degree), knots(std::move(_knots)), control_points(std::move(_control_points))
+        {
+            assert(knots.size() == control_points.size() + degree + 1);
+            breakpoints.build(knots.data(), knots.size(), degree);
+
+            numerators.resize(control_points.size());
+            weights.resize(control_points.size());
+            rational = false;
+            for(size_t i = 0; i < control_points.size(); i++)
+            {
+                numerators[i] = glm::vec3(control_points[i]);
+                weights[i] = control_points[i].w;
+                rational |= control_points[i].w != 1.0f;
+            }
+        }
+
+        float domain_begin() const
+        {
+            return knots[degree];
+        }
+
+        float domain_end() const
+        {
+            return knots[control_points.size()];
+        }
+
+        glm::vec3 evaluate(float t) const
+        {
+            int span = breakpoints.find_span(t);
+            glm::vec3 point = evaluate_curve_span(knots.data(), span, degree, &numerators[span - degree], t);
+            if(rational)
+            {
+                point /= evaluate_weight(span, t);
+            }
+            return point;
+        }
+
+        // points at params[0 .. count), monotone params reuse the span of the previous one
+        void evaluate_many(const float* params, size_t count, glm::vec3* result) const
+        {
+            if(count == 0)
+            {
+                return;
+            }
+            evaluate_curve_batch(breakpoints, knots.data(), degree, numerators.data(), params, count,
+                                 &result[0].x, &result[0].y, &result[0].z, 3);
+            if(!rational)
+            {
+                return;
+            }
+
+            int hint = -1;
+            for(size_t i = 0; i < count; i++)
+            {
+                result[i] /= evaluate_weight(breakpoints.find_span(params[i], hint), params[i]);
+            }
+        }
+
+        // count points evenly spaced over the domain, both ends included
+        void sample_uniform(size_t count, glm::vec3* result) const
+        {
+            float begin = domain_begin();
+            float delta = count > 1 ? (domain_end() - begin) / (float)(count - 1) : 0.0f;
+
+            std::vector<float> params(count);
+            for(size_t i = 0; i < count; i++)
+            {
+                params[i] = (i + 1 == count && count > 1) ? domain_end() : begin + i * delta;
+            }
+            evaluate_many(params.data(), count, result);
+        }
+
+        int get_degree() const
+        {
+            return degree;
+        }
+
+        const std::vector<float>& get_knot_vector() const
+        {
+            return knots;
+        }
+
+        const std::vector<glm::vec4>& get_control_points() const
+        {
+            return control_points;
+        }
+
+    private:
+        // one blending pass and a dot product, the weight has a single coordinate
+        float evaluate_weight(int span, float t) const
+        {
+            float basis[MAX_BSPLINE_DEGREE + 1];
+            compute_basis_funcs(knots.data(), span, degree, t, basis);
+
+            const float* w = &weights[span - degree];
+            float result = 0.0f;
+            for(int r = 0; r <= degree; r++)
+            {
+                result += basis[r] * w[r];
+            }
+            return result;
+        }
+
+        int degree;
+        std::vector<float> knots;
+        std::vector<glm::vec4> control_points;
+        KnotBreakpoints breakpoints;
+        // (w * x, w * y, w * z) of every control point, the layout the curve kernels read, and w
+        std::vector<glm::vec3> numerators;
+        std::vector<float> weights;
+        bool rational;
+    };
+} // namespace MH
@@ -7,7 +7,9 @@
 #include "serializer.h"
 #include "ImGuizmo.h"
 #include "imgui.h"
-#include "matrix.h"
+#include "curve_fitting.h"
+#include "surface_fitting.h"
+#include "surface_shader.h"
 
 namespace MH
 {
@@ -92,6 +94,7 @@ namespace MH
         camera = new Camera(window->get_width(), window->get_height());
         
         defaultShader = new Shader("default.vert", "default.frag");
+        surfaceShader = create_surface_shader();
         
         glfwSetScrollCallback((GLFWwindow*)window->get_native_window(), [](GLFWwindow* window, double dx, double dy)
         {
@@ -171,13 +174,53 @@ namespace MH
                     if(surfaceSelectedIndex != -1)
                     {
                         auto surface = group->bspline_surfaces[surfaceSelectedIndex];
+                        ImGui::Checkbox("Toggle Shaded Display", &surface->shaded_display);
+                        if(surface->shaded_display)
+                        {
+                            if(ImGui::Checkbox("Adaptive", &surface->adaptive_tessellation))
+                            {
+                                surface->invalidate_derived_data(SURFACE_SHADED_MESH);
+                            }
+                            if(surface->adaptive_tessellation && ImGui::InputFloat("Tolerance", &surface->adaptive_tolerance, 0.0f, 0.0f, "%.5f"))
+                            {
+                                surface->adaptive_tolerance = std::max(surface->adaptive_tolerance, 0.00001f);
+                                surface->invalidate_derived_data(SURFACE_SHADED_MESH);
+                            }
+                        }
                         ImGui::Checkbox("Toggle General Display", &surface->general_display);
                         ImGui::Checkbox("Toggle Nodal Display", &surface->nodal_display);
                         if(surface->ForNodal)
                         {
                             ImGui::Checkbox("Toggle Nodal Curve Display", &surface->nodal_curvedisplay);
+                            if(ImGui::TreeNode("Nodal Curves"))
+                            {
+                                // the factorization is cached, so every edit is two banded solves
+                                bool moved = false;
+                                for(size_t curve_index = 0; curve_index < surface->nodal_curves.size(); curve_index++)
+                                {
+                                    auto curve = surface->nodal_curves[curve_index];
+                                    auto& control_points = curve->get_control_points();
+                                    for(size_t i = 0; i < control_points.size(); i++)
+                                    {
+                                        if(ImGui::InputFloat3(Format("#%d %d", (int)curve_index, (int)i).c_str(), &(control_points[i][0])))
+                                        {
+                                            curve->mark_control_point_moved(i);
+                                            moved = true;
+                                        }
+                                    }
+                                }
+                                if(moved)
+                                {
+                                    surface->interpolate_nodal_curves();
+                                }
+                                ImGui::TreePop();
+                            }
                         }
                         ImGui::Checkbox("Toggle Knot Display", &surface->knot_display);
+                        if(surfaceHitIndex == surfaceSelectedIndex)
+                        {
+                            ImGui::Text("Picked u %.4f v %.4f", surfaceHitParameters.x, surfaceHitParameters.y);
+                        }
                     }
                     
                     ImGui::EndTabItem();
@@ -193,7 +236,7 @@ namespace MH
                         {
                             if(ImGui::InputFloat3(Format("#%d", (int)i).c_str(), &(control_points[i][0])))
                             {
-                                curve->mark_need_update();
+                                curve->mark_control_point_moved(i);
                             }
                             ImGui::SameLine();
                             ImGui::PushID(i);
@@ -291,7 +334,36 @@ namespace MH
                         ImGui::Checkbox("Polygon Display", &curve->show_polygon);
                         
                         ImGui::Checkbox("Special Color", &curve->is_special_color);
-                        
+
+                        if(ImGui::RadioButton("Uniform", &curve->sample_mode, SAMPLE_BY_PARAMETER))
+                        {
+                            curve->mark_need_update();
+                        }
+                        ImGui::SameLine();
+                        if(ImGui::RadioButton("Adaptive", &curve->sample_mode, SAMPLE_BY_FORWARD_DIFFERENCING))
+                        {
+                            curve->mark_need_update();
+                        }
+                        ImGui::SameLine();
+                        if(ImGui::RadioButton("Arc Length", &curve->sample_mode, SAMPLE_BY_ARC_LENGTH))
+                        {
+                            curve->mark_need_update();
+                        }
+                        if(curve->sample_mode == SAMPLE_BY_FORWARD_DIFFERENCING)
+                        {
+                            if(ImGui::InputFloat("Tolerance", &curve->sample_tolerance, 0.0f, 0.0f, "%.5f"))
+                            {
+                                curve->mark_need_update();
+                            }
+                        }
+                        if(curve->sample_mode == SAMPLE_BY_ARC_LENGTH)
+                        {
+                            if(ImGui::InputInt("Samples", &curve->arc_length_sample_count))
+                            {
+                                curve->mark_need_update();
+                            }
+                        }
+
                         if(ImGui::Button("degree raise"))
                         {
                             curve->set_degree(curve->get_degree() + 1);
@@ -319,6 +391,31 @@ namespace MH
                             newCurve->is_special_color = curve->is_special_color;
                         }
                         
+                        // the control points taken as data points of a new curve
+                        static int fit_parameterization = PARAMETERIZE_CHORD_LENGTH;
+                        static int fit_control_count = 8;
+                        ImGui::RadioButton("Chord Length", &fit_parameterization, PARAMETERIZE_CHORD_LENGTH); ImGui::SameLine();
+                        ImGui::RadioButton("Centripetal", &fit_parameterization, PARAMETERIZE_CENTRIPETAL);
+                        if(ImGui::Button("Interpolate Points"))
+                        {
+                            auto fitted = interpolate_curve(curve->get_control_points(), curve->get_degree(), fit_parameterization);
+                            if(fitted)
+                            {
+                                fitted->set_dimension(curve->get_dimension());
+                                group->add_child(fitted);
+                            }
+                        }
+                        ImGui::InputInt("Fit Control Points", &fit_control_count);
+                        if(ImGui::Button("Fit Points"))
+                        {
+                            auto fitted = fit_curve(curve->get_control_points(), fit_control_count, curve->get_degree(), fit_parameterization);
+                            if(fitted)
+                            {
+                                fitted->set_dimension(curve->get_dimension());
+                                group->add_child(fitted);
+                            }
+                        }
+                        
                         static float whole_curve_move = 0.0f;
                         ImGui::InputFloat("Move Delta", &whole_curve_move);
                         if(ImGui::Button("Right"))
@@ -409,6 +506,7 @@ namespace MH
                 current_path = pathBuf;
                 
                 group->clear();
+                surfaceHitIndex = -1;
                 auto curves = deserialize(pathBuf);
                 for(int i = 0; i < curves.size(); i++)
                 {
@@ -478,15 +576,36 @@ namespace MH
             static int FILE_OPTION = 0;
             ImGui::RadioButton("Surface", &FILE_OPTION, 0); ImGui::SameLine();
             ImGui::RadioButton("Nodal", &FILE_OPTION, 1); ImGui::SameLine();
+            ImGui::RadioButton("Point Cloud", &FILE_OPTION, 2); ImGui::SameLine();
+            
+            // least squares surface fitted to the cloud, parameterized over its plane or the selected surface
+            static int fit_control_counts[2] = {16, 16};
+            static int fit_degree = 3;
+            static bool fit_onto_selected = false;
+            if(FILE_OPTION == 2)
+            {
+                ImGui::NewLine();
+                ImGui::InputInt2("Control Points", fit_control_counts);
+                ImGui::InputInt("Degree", &fit_degree);
+                ImGui::Checkbox("Onto Selected Surface", &fit_onto_selected);
+            }
             
             ImGui::NewLine();
             if (ImGui::Button("OK", ImVec2(120, 0)))
             {
                 current_path = pathBuf;
                 
+                // taken before a clear drops it
+                std::shared_ptr<BSplineSurface> base;
+                if(FILE_OPTION == 2 && fit_onto_selected && surfaceSelectedIndex != -1 && surfaceSelectedIndex < (int)group->bspline_surfaces.size())
+                {
+                    base = group->bspline_surfaces[surfaceSelectedIndex];
+                }
+                
                 if(READING_OPTION == 1)
                 {
                     group->clear();
+                    surfaceHitIndex = -1;
                 }
                 
                 if(FILE_OPTION == 0)
@@ -509,6 +628,19 @@ namespace MH
                         group->add_child(surface);
                     }
                 }
+                else if(FILE_OPTION == 2)
+                {
+                    auto points = deserialize_point_cloud(current_path);
+                    auto surface = fit_point_cloud(points, fit_control_counts[0], fit_control_counts[1], fit_degree, fit_degree, base.get());
+                    if(surface)
+                    {
+                        group->add_child(surface);
+                    }
+                    else
+                    {
+                        LOG_ERROR("could not fit a surface to {} points of {}", points.size(), current_path);
+                    }
+                }
                 else
                 {
                     assert(true);
@@ -547,6 +679,17 @@ namespace MH
                                             0.0f, 1.0f));
         };
         
+        // camera ray through a screen position, from the near plane towards the far plane
+        auto screen_to_ray = [&viewInverse, &projectionInverse, this](glm::vec2 screen_pos, glm::vec3& origin, glm::vec3& direction)
+        {
+            auto screenX = (screen_pos.x - window->get_width() * 0.5f) / (window->get_width() * 0.5f);
+            auto screenY = -1.0f * (screen_pos.y - window->get_height() * 0.5f) / (window->get_height() * 0.5f);
+            auto near_point = viewInverse * (projectionInverse * glm::vec4(screenX, screenY, -1.0f, 1.0f));
+            auto far_point = viewInverse * (projectionInverse * glm::vec4(screenX, screenY, 1.0f, 1.0f));
+            origin = glm::vec3(near_point) / near_point.w;
+            direction = glm::vec3(far_point) / far_point.w - origin;
+        };
+        
 //        auto screen_to_world_relative = [&view, &projection, &viewInverse, &projectionInverse, this](glm::vec2 screen_pos)
 //        {
 //            auto screenX = (screen_pos.x) / (window->get_width() * 0.5f);
@@ -656,6 +799,20 @@ namespace MH
                 }
             }
             
+            if(surfaceHitIndex != -1 && surfaceHitIndex == surfaceSelectedIndex)
+            {
+                for(auto& line : surfaceHitIsoLines)
+                {
+                    std::vector<ImVec2> screen_points(line.size());
+                    for(size_t i = 0; i < line.size(); i++)
+                    {
+                        screen_points[i] = world_to_screen(line[i]);
+                    }
+                    overlay_drawList->AddPolyline(screen_points.data(), screen_points.size(), IM_COL32(255, 200, 0, 160), false, 1.5f);
+                }
+                overlay_drawList->AddCircleFilled(world_to_screen(surfaceHitPoint), 4.0f, IM_COL32(255, 200, 0, 255));
+            }
+            
             if(isDragging && ImGui::IsMouseReleased(0))
             {
                 isDragging = false;
@@ -683,7 +840,7 @@ namespace MH
                 
                 if(delta_length >= 0.000001f)
                 {
-                    child->mark_need_update();
+                    child->mark_control_point_moved(selectedPointIndex);
                 }
             }
         }
@@ -715,6 +872,42 @@ namespace MH
             group->add_child(curve);
         }
         
+        // v + click selects the nearest surface under the mouse and the location hit on it
+        if(ImGui::IsMouseClicked(0) && ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_V)) && !camera->is_ortho)
+        {
+            glm::vec3 origin;
+            glm::vec3 direction;
+            screen_to_ray(pos, origin, direction);
+            
+            float nearest = INFINITY;
+            surfaceHitIndex = -1;
+            for(int surface_index = 0; surface_index < group->bspline_surfaces.size(); surface_index++)
+            {
+                BSplineSurface::SurfaceHit hit;
+                if(group->bspline_surfaces[surface_index]->intersect_ray(origin, direction, hit) && hit.t < nearest)
+                {
+                    nearest = hit.t;
+                    surfaceHitIndex = surface_index;
+                    surfaceHitParameters = glm::vec2(hit.u, hit.v);
+                    surfaceHitPoint = hit.position;
+                }
+            }
+            
+            if(surfaceHitIndex != -1)
+            {
+                surfaceSelectedIndex = surfaceHitIndex;
+                camera->surface = group->bspline_surfaces[surfaceHitIndex];
+                
+                auto surface = group->bspline_surfaces[surfaceHitIndex];
+                IsoCurve iso_curves[2] = {surface->iso_curve_u(surfaceHitParameters.x), surface->iso_curve_v(surfaceHitParameters.y)};
+                for(int i = 0; i < 2; i++)
+                {
+                    surfaceHitIsoLines[i].resize(PICKED_ISO_LINE_SAMPLES);
+                    iso_curves[i].sample_uniform(PICKED_ISO_LINE_SAMPLES, surfaceHitIsoLines[i].data());
+                }
+            }
+        }
+        
         if(ImGui::IsMouseClicked(0) && ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Z)))
         {
             glm::vec3 worldPos = screen_to_world(pos);
@@ -832,6 +1025,12 @@ namespace MH
             defaultShader->setMat4("projection", projection);
             defaultShader->setMat4("view", view);
             defaultShader->setMat4("model", model);// in this editor, model always is identity
+            
+            surfaceShader->use();
+            surfaceShader->setMat4("projection", projection);
+            surfaceShader->setMat4("view", view);
+            surfaceShader->setMat4("model", model);
+            defaultShader->use();
 
     //        glBindVertexArray(VAO);
     //        glDrawArrays(GL_TRIANGLES, 0, 3);
@@ -844,7 +1043,7 @@ namespace MH
             for(int i = 0; i < group->bspline_surfaces.size(); i++)
             {
                 auto child = group->bspline_surfaces[i];
-                child->draw(defaultShader);
+                child->draw(defaultShader, surfaceShader);
             }
 //            bspline->draw();
         }
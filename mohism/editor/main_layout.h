@@ -3,6 +3,11 @@
 #include "imgui.h"
 #include "glad/glad.h"
 #include "core/window.h"
+#include "glm/vec3.hpp"
+#include <vector>
+
+// points per iso-curve drawn through a picked surface point
+#define PICKED_ISO_LINE_SAMPLES 128
 
 namespace MH
 {
@@ -28,9 +33,18 @@ namespace MH
         
         int surfaceSelectedIndex = -1;
         
+        // surface location picked under the mouse, index -1 when there is none
+        int surfaceHitIndex = -1;
+        glm::vec2 surfaceHitParameters;
+        glm::vec3 surfaceHitPoint;
+        // the iso-curves of the picked surface through the picked point, sampled in model space
+        std::vector<glm::vec3> surfaceHitIsoLines[2];
+        
         std::string current_path = "";
         
         Shader* defaultShader;
+        // lit shaded view of surfaces
+        Shader* surfaceShader;
         Window* window;
         std::shared_ptr<CurveGroup> group;
     };
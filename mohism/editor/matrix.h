@@ -1,108 +1,513 @@
 #pragma once
-#define N 50
 
-double getA(double arcs[N][N],int n)
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <new>
+
+// byte alignment of matrix storage, one cache line
+#define MATRIX_ALIGNMENT 64
+
+namespace MH
 {
-    if(n==1)
-    {
-        return arcs[0][0];
-    }
-    double ans = 0;
-    double temp[N][N]={0.0};
-    int i,j,k;
-    for(i=0;i<n;i++)
+    // rows x columns doubles on the heap, row major and densely packed, zero filled on resize
+    class Matrix
     {
-        for(j=0;j<n-1;j++)
+    public:
+        Matrix() = default;
+
+        Matrix(int _rows, int _columns)
+        {
+            resize(_rows, _columns);
+        }
+
+        Matrix(const Matrix& other)
+        {
+            *this = other;
+        }
+
+        Matrix(Matrix&& other) noexcept
         {
-            for(k=0;k<n-1;k++)
+            *this = std::move(other);
+        }
+
+        Matrix& operator=(const Matrix& other)
+        {
+            if(this != &other)
             {
-                temp[j][k] = arcs[j+1][(k>=i)?k+1:k];
-                
+                allocate(other.rows, other.columns);
+                std::copy(other.data(), other.data() + other.get_count(), data());
             }
+            return *this;
         }
-        double t = getA(temp,n-1);
-        if(i%2==0)
+
+        // leaves other as an empty 0 x 0 matrix
+        Matrix& operator=(Matrix&& other) noexcept
         {
-            ans += arcs[0][i]*t;
+            if(this != &other)
+            {
+                storage = std::move(other.storage);
+                rows = other.rows;
+                columns = other.columns;
+                other.rows = 0;
+                other.columns = 0;
+            }
+            return *this;
         }
-        else
+
+        void resize(int _rows, int _columns)
         {
-            ans -=  arcs[0][i]*t;
+            allocate(_rows, _columns);
+            fill(0.0);
         }
-    }
-    return ans;
-}
 
-void getAStar(double arcs[N][N],int n,double ans[N][N])
-{
-    if(n==1)
-    {
-        ans[0][0] = 1;
-        return;
-    }
-    int i,j,k,t;
-    double temp[N][N];
-    for(i=0;i<n;i++)
+        void fill(double value)
+        {
+            std::fill(data(), data() + get_count(), value);
+        }
+
+        double& operator()(int i, int j)
+        {
+            return storage[i * columns + j];
+        }
+
+        double operator()(int i, int j) const
+        {
+            return storage[i * columns + j];
+        }
+
+        double* row(int i)
+        {
+            return storage.get() + i * columns;
+        }
+
+        const double* row(int i) const
+        {
+            return storage.get() + i * columns;
+        }
+
+        double* data()
+        {
+            return storage.get();
+        }
+
+        const double* data() const
+        {
+            return storage.get();
+        }
+
+        int get_rows() const
+        {
+            return rows;
+        }
+
+        int get_columns() const
+        {
+            return columns;
+        }
+
+        size_t get_count() const
+        {
+            return (size_t)rows * columns;
+        }
+
+    private:
+        struct AlignedDelete
+        {
+            void operator()(double* pointer) const
+            {
+                ::operator delete[](pointer, std::align_val_t(MATRIX_ALIGNMENT));
+            }
+        };
+
+        // keeps the storage when the element count is unchanged
+        void allocate(int _rows, int _columns)
+        {
+            size_t count = (size_t)_rows * _columns;
+            if(count != get_count() || !storage)
+            {
+                storage.reset(count > 0 ? static_cast<double*>(::operator new[](count * sizeof(double), std::align_val_t(MATRIX_ALIGNMENT))) : nullptr);
+            }
+            rows = _rows;
+            columns = _columns;
+        }
+
+        int rows = 0;
+        int columns = 0;
+        std::unique_ptr<double[], AlignedDelete> storage;
+    };
+
+    // P A = L U with partial pivoting, factor once, then solve for any number of right hand sides without an inverse
+    class LUFactorization
     {
-        for(j=0;j<n;j++)
+    public:
+        // a is n x n, row major with stride entries per row, false when a pivot vanishes
+        bool factor(const double* a, int n, int stride)
+        {
+            size = n;
+            lu.resize(n, n);
+            pivots.resize(n);
+            for(int i = 0; i < n; i++)
+            {
+                std::copy(a + i * stride, a + i * stride + n, lu.row(i));
+            }
+
+            for(int k = 0; k < n; k++)
+            {
+                int pivot = k;
+                for(int i = k + 1; i < n; i++)
+                {
+                    if(std::abs(lu(i, k)) > std::abs(lu(pivot, k)))
+                    {
+                        pivot = i;
+                    }
+                }
+                pivots[k] = pivot;
+                if(lu(pivot, k) == 0.0)
+                {
+                    return false;
+                }
+                if(pivot != k)
+                {
+                    std::swap_ranges(lu.row(k), lu.row(k) + n, lu.row(pivot));
+                }
+
+                double diagonal = lu(k, k);
+                for(int i = k + 1; i < n; i++)
+                {
+                    double multiplier = lu(i, k) / diagonal;
+                    lu(i, k) = multiplier;
+                    for(int j = k + 1; j < n; j++)
+                    {
+                        lu(i, j) -= multiplier * lu(k, j);
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool factor(const Matrix& a)
+        {
+            return factor(a.data(), a.get_rows(), a.get_columns());
+        }
+
+        // every column of b is a right hand side
+        void solve(Matrix& b) const
+        {
+            solve(b.data(), b.get_columns(), b.get_columns());
+        }
+
+        // b is n x rhs_count, row major with stride entries per row, overwritten with the solution
+        void solve(double* b, int rhs_count, int stride) const
         {
-            for(k=0;k<n-1;k++)
+            int n = size;
+            for(int k = 0; k < n; k++)
             {
-                for(t=0;t<n-1;t++)
+                if(pivots[k] != k)
                 {
-                    temp[k][t] = arcs[k>=i?k+1:k][t>=j?t+1:t];
+                    std::swap_ranges(b + k * stride, b + k * stride + rhs_count, b + pivots[k] * stride);
                 }
             }
-            
-            
-            ans[j][i]  =  getA(temp,n-1);
-            if((i+j)%2 == 1)
+
+            for(int i = 1; i < n; i++)
             {
-                ans[j][i] = - ans[j][i];
+                for(int k = 0; k < i; k++)
+                {
+                    double multiplier = lu(i, k);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[i * stride + c] -= multiplier * b[k * stride + c];
+                    }
+                }
+            }
+
+            for(int i = n - 1; i >= 0; i--)
+            {
+                for(int j = i + 1; j < n; j++)
+                {
+                    double multiplier = lu(i, j);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[i * stride + c] -= multiplier * b[j * stride + c];
+                    }
+                }
+                double diagonal = lu(i, i);
+                for(int c = 0; c < rhs_count; c++)
+                {
+                    b[i * stride + c] /= diagonal;
+                }
             }
         }
-    }
-}
 
-void MatrixMultiply(double matrix_a[N][N],double matrix_b[N][N], double matrix_result[N][N], int size_m, int size_n, int size_s)
-{
-    for(int m = 0; m < size_m; m++)
+        int get_size() const
+        {
+            return size;
+        }
+
+    private:
+        int size = 0;
+        Matrix lu;
+        std::vector<int> pivots;
+    };
+
+    // lu with partial pivoting for a matrix with lower entries below and upper entries above the diagonal in each row,
+    // such as a b-spline collocation matrix, O(n (lower + upper) lower) work instead of O(n^3),
+    // row swaps widen the upper band of U to lower + upper so every row keeps 2 lower + upper + 1 slots
+    class BandedLUFactorization
     {
-        for(int s=0; s < size_s; s++)
+    public:
+        // n x n zero matrix with the given bandwidths, fill it through at
+        void reset(int n, int _lower, int _upper)
+        {
+            size = n;
+            lower = _lower;
+            upper = _upper;
+            width = 2 * lower + upper + 1;
+            band.resize(n, width);
+            pivots.assign(n, 0);
+        }
+
+        // entry (i, j), j - i must lie in [-lower, upper] before factor
+        double& at(int i, int j)
         {
-            matrix_result[m][s] = 0;
-            
-            for(int n = 0; n < size_n; n++)
+            return band(i, j - i + lower);
+        }
+
+        double at(int i, int j) const
+        {
+            return band(i, j - i + lower);
+        }
+
+        // false when a pivot vanishes
+        bool factor()
+        {
+            int n = size;
+            for(int k = 0; k < n; k++)
             {
-                matrix_result[m][s] += matrix_a[m][n] * matrix_b[n][s];
+                int last_row = std::min(k + lower, n - 1);
+                int last_column = std::min(k + lower + upper, n - 1);
+
+                int pivot = k;
+                for(int i = k + 1; i <= last_row; i++)
+                {
+                    if(std::abs(at(i, k)) > std::abs(at(pivot, k)))
+                    {
+                        pivot = i;
+                    }
+                }
+                pivots[k] = pivot;
+                if(at(pivot, k) == 0.0)
+                {
+                    return false;
+                }
+                if(pivot != k)
+                {
+                    for(int j = k; j <= last_column; j++)
+                    {
+                        std::swap(at(k, j), at(pivot, j));
+                    }
+                }
+
+                double diagonal = at(k, k);
+                for(int i = k + 1; i <= last_row; i++)
+                {
+                    double multiplier = at(i, k) / diagonal;
+                    at(i, k) = multiplier;
+                    if(multiplier == 0.0)
+                    {
+                        continue;
+                    }
+                    for(int j = k + 1; j <= last_column; j++)
+                    {
+                        at(i, j) -= multiplier * at(k, j);
+                    }
+                }
             }
+            return true;
         }
-    }
-}
 
-bool GetMatrixInverse(double src[N][N], int n, double des[N][N])
-{
-    double flag=getA(src,n);
-    double t[N][N];
-    if(flag==0)
-    {
-        return false;
-    }
-    else
+        // every column of b is a right hand side
+        void solve(Matrix& b) const
+        {
+            solve(b.data(), b.get_columns(), b.get_columns());
+        }
+
+        // b is n x rhs_count, row major with stride entries per row, overwritten with the solution,
+        // the row swaps are replayed in factorization order since the multipliers are stored unswapped
+        void solve(double* b, int rhs_count, int stride) const
+        {
+            int n = size;
+            for(int k = 0; k < n; k++)
+            {
+                if(pivots[k] != k)
+                {
+                    std::swap_ranges(b + k * stride, b + k * stride + rhs_count, b + pivots[k] * stride);
+                }
+                int last_row = std::min(k + lower, n - 1);
+                for(int i = k + 1; i <= last_row; i++)
+                {
+                    double multiplier = at(i, k);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[i * stride + c] -= multiplier * b[k * stride + c];
+                    }
+                }
+            }
+
+            for(int i = n - 1; i >= 0; i--)
+            {
+                int last_column = std::min(i + lower + upper, n - 1);
+                for(int j = i + 1; j <= last_column; j++)
+                {
+                    double multiplier = at(i, j);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[i * stride + c] -= multiplier * b[j * stride + c];
+                    }
+                }
+                double diagonal = at(i, i);
+                for(int c = 0; c < rhs_count; c++)
+                {
+                    b[i * stride + c] /= diagonal;
+                }
+            }
+        }
+
+        int get_size() const
+        {
+            return size;
+        }
+
+    private:
+        int size = 0;
+        int lower = 0;
+        int upper = 0;
+        int width = 1;
+        // row i holds columns i - lower ... i + lower + upper
+        Matrix band;
+        std::vector<int> pivots;
+    };
+
+    // L L^T of a symmetric positive definite matrix with bandwidth entries on each side of the diagonal,
+    // such as least squares normal equations of b-splines, only the lower band is stored, O(n bandwidth^2) work
+    class BandedCholeskyFactorization
     {
-        getAStar(src,n,t);
-        for(int i=0;i<n;i++)
+    public:
+        // n x n zero matrix, fill its lower band through at
+        void reset(int n, int _bandwidth)
+        {
+            size = n;
+            bandwidth = _bandwidth;
+            band.resize(n, bandwidth + 1);
+        }
+
+        // entry (i, j) with j in [i - bandwidth, i], (j, i) is the same entry
+        double& at(int i, int j)
+        {
+            return band(i, j - i + bandwidth);
+        }
+
+        double at(int i, int j) const
+        {
+            return band(i, j - i + bandwidth);
+        }
+
+        // false when the matrix is not positive definite
+        bool factor()
+        {
+            int n = size;
+            for(int i = 0; i < n; i++)
+            {
+                int first = std::max(0, i - bandwidth);
+                const double* row_i = band.row(i) + bandwidth - i;
+                for(int j = first; j <= i; j++)
+                {
+                    // both rows hold columns max(first, j - bandwidth) ... j - 1 of L contiguously
+                    const double* row_j = band.row(j) + bandwidth - j;
+                    double sum = at(i, j);
+                    for(int k = std::max(first, j - bandwidth); k < j; k++)
+                    {
+                        sum -= row_i[k] * row_j[k];
+                    }
+
+                    if(j < i)
+                    {
+                        at(i, j) = sum / at(j, j);
+                    }
+                    else if(sum > 0.0)
+                    {
+                        at(i, i) = std::sqrt(sum);
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // b is n x rhs_count, row major with stride entries per row, overwritten with the solution
+        void solve(double* b, int rhs_count, int stride) const
         {
-            for(int j=0;j<n;j++)
+            int n = size;
+            for(int i = 0; i < n; i++)
             {
-                des[i][j]=t[i][j]/flag;
+                for(int k = std::max(0, i - bandwidth); k < i; k++)
+                {
+                    double multiplier = at(i, k);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[i * stride + c] -= multiplier * b[k * stride + c];
+                    }
+                }
+                double diagonal = at(i, i);
+                for(int c = 0; c < rhs_count; c++)
+                {
+                    b[i * stride + c] /= diagonal;
+                }
+            }
+
+            for(int i = n - 1; i >= 0; i--)
+            {
+                double diagonal = at(i, i);
+                for(int c = 0; c < rhs_count; c++)
+                {
+                    b[i * stride + c] /= diagonal;
+                }
+                // column i of L^T is row i of L
+                for(int k = std::max(0, i - bandwidth); k < i; k++)
+                {
+                    double multiplier = at(i, k);
+                    for(int c = 0; c < rhs_count; c++)
+                    {
+                        b[k * stride + c] -= multiplier * b[i * stride + c];
+                    }
+                }
             }
-            
         }
-    }
-    
-    
-    return true;
-    
-}
 
+        // every column of b is a right hand side
+        void solve(Matrix& b) const
+        {
+            solve(b.data(), b.get_columns(), b.get_columns());
+        }
+
+        int get_size() const
+        {
+            return size;
+        }
+
+        int get_bandwidth() const
+        {
+            return bandwidth;
+        }
+
+    private:
+        int size = 0;
+        int bandwidth = 0;
+        // row i holds columns i - bandwidth ... i
+        Matrix band;
+    };
+} // namespace MH
@@ -3,7 +3,6 @@
 #include "bspline.h"
 #include "string_utils.h"
 #include "curve_group.h"
-#include "matrix.h"
 
 namespace MH
 {
@@ -71,6 +70,8 @@ static std::vector<std::shared_ptr<BSplineSurface>> deserialize_surface(const st
     }
     
     std::vector<std::shared_ptr<BSplineSurface>> result;
+    // surfaces whose control net was read to the end
+    std::vector<std::shared_ptr<BSplineSurface>> completed;
     
     std::istringstream f(content);
     std::string currentLine;
@@ -223,7 +224,7 @@ static std::vector<std::shared_ptr<BSplineSurface>> deserialize_surface(const st
                     currentY++;
                     if(currentY > m)
                     {
-                        current_bspline_surface->compute_derived_date();
+                        completed.push_back(current_bspline_surface);
                         // next surface
                         type = 1;
                     }
@@ -232,6 +233,27 @@ static std::vector<std::shared_ptr<BSplineSurface>> deserialize_surface(const st
         }
     }
     
+    // model splines own gl objects and the upload needs the context, both stay on this thread,
+    // the tessellation in between runs on the pool
+    for(auto& surface : completed)
+    {
+        surface->compute_domain();
+        surface->compute_model_spline();
+    }
+    
+    ThreadPool::get().parallel_for(completed.size(), 1, [&completed](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+        {
+            completed[i]->tessellate();
+        }
+    });
+    
+    for(auto& surface : completed)
+    {
+        surface->upload_render_data();
+    }
+    
     return result;
 }
 
@@ -392,6 +414,55 @@ static std::vector<std::shared_ptr<BSpline>> deserialize(const std::string &path
     return result;
 }
     
+// one point per line as x y z, lines starting with # are comments, scanned clouds run to millions of lines
+// so numbers are read straight from the buffer instead of through tokens
+static std::vector<glm::vec3> deserialize_point_cloud(const std::string &path)
+{
+    auto content = ReadFile(path);
+    if (content.size() == 0)
+    {
+        content = ReadFile("assets/" + path);
+    }
+    
+    std::vector<glm::vec3> result;
+    
+    const char* cursor = content.c_str();
+    const char* end = cursor + content.size();
+    while (cursor < end)
+    {
+        const char* line_end = std::find(cursor, end, '\n');
+        while (cursor < line_end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+        {
+            cursor++;
+        }
+        
+        if (cursor < line_end && *cursor != '#')
+        {
+            glm::vec3 point;
+            char* number_end = nullptr;
+            int read = 0;
+            for (; read < 3; read++)
+            {
+                point[read] = std::strtof(cursor, &number_end);
+                if (number_end == cursor || number_end > line_end)
+                {
+                    break;
+                }
+                cursor = number_end;
+            }
+            
+            if (read == 3)
+            {
+                result.push_back(point);
+            }
+        }
+        
+        cursor = line_end + 1;
+    }
+    
+    return result;
+}
+
 static std::vector<std::shared_ptr<BSplineSurface>> deserialize_nodal(const std::string &path)
 {
     auto content = ReadFile(path);
@@ -571,81 +642,12 @@ static std::vector<std::shared_ptr<BSplineSurface>> deserialize_nodal(const std:
     surface->compute_domain();
     surface->compute_model_spline();
     
-    int n = surface->knot_length_v - surface->degree_v - 1 - 1;
-    int m = surface->knot_length_u - surface->degree_u - 1 - 1;
-    
-    // compute control points
-    // build H matrix
-    double H_X[50][50] = {};
-    double H_Y[50][50] = {};
-    double H_Z[50][50] = {};
-    
-    for(int i = 0; i <= n; i++)
+    if(!surface->interpolate_nodal_curves())
     {
-        for(int j = 0; j <= m; j++)
-        {
-            auto theCurve = curves[i];
-            H_X[j][i] = theCurve->get_control_points()[j].x;
-            H_Y[j][i] = theCurve->get_control_points()[j].y;
-            H_Z[j][i] = theCurve->get_control_points()[j].z;
-        }
+        LOG_ERROR("nodal interpolation of {} is singular", path);
+        return {};
     }
     
-    // Build F Matrix
-    double F[50][50] = {};
-    for(int i = 0; i <= m; i++)
-    {
-        for(int j = 0; j <= m; j++)
-        {
-            F[j][i] = surface->get_nodal_blending_u(i, j);
-        }
-    }
-    
-    // Build F Inverse
-    double FInverse[50][50] = {};
-    GetMatrixInverse(F, m + 1, FInverse);
-    
-    // Build G Transpose
-    double GTranspose[50][50] = {};
-    for(int i = 0; i <= n; i++)
-    {
-        for(int j = 0; j <= n; j++)
-        {
-            GTranspose[i][j] = surface->get_nodal_blending_v(i, j);
-        }
-    }
-    
-    // Build G Transpose Inverse
-    double GTransposeInverse[50][50] = {};
-    GetMatrixInverse(GTranspose, n + 1, GTransposeInverse);
-    
-    // Calcu FInverse * H
-    double FIHX[50][50] = {};
-    double FIHY[50][50] = {};
-    double FIHZ[50][50] = {};
-    MatrixMultiply(FInverse, H_X, FIHX, m + 1, m + 1, n + 1);
-    MatrixMultiply(FInverse, H_Y, FIHY, m + 1, m + 1, n + 1);
-    MatrixMultiply(FInverse, H_Z, FIHZ, m + 1, m + 1, n + 1);
-    
-    // calcu FIH * GTranspose Inverse
-    double CX[50][50] = {};
-    double CY[50][50] = {};
-    double CZ[50][50] = {};
-    MatrixMultiply(FIHX, GTransposeInverse, CX, m + 1, n + 1, n + 1);
-    MatrixMultiply(FIHY, GTransposeInverse, CY, m + 1, n + 1, n + 1);
-    MatrixMultiply(FIHZ, GTransposeInverse, CZ, m + 1, n + 1, n + 1);
-    
-    for(int j = 0; j <= m; j++)
-    {
-        for(int i = 0; i <= n; i++)
-        {
-            glm::vec4 point = glm::vec4(CX[j][i], CY[j][i], CZ[j][i], 1.0f);
-            surface->control_points.push_back(point);
-        }
-    }
-    
-    surface->compute_derived_data_for_nodal();
-    
     return result;
 }
 
@@ -0,0 +1,395 @@
+#pragma once
+
+#include "bspline.h"
+#include "matrix.h"
+#include "core/thread_pool.h"
+#include "glm/mat3x3.hpp"
+#include "glm/matrix.hpp"
+
+// points handed to a worker at a time by the passes over a point cloud
+#define SURFACE_FIT_POINTS_PER_TASK 65536
+
+// weight of the membrane energy of the control net against the data, per data point and control point,
+// holds control points without data near their neighbours and keeps the normal equations definite
+#define SURFACE_FIT_SMOOTHING 0.0001f
+
+// jacobi sweeps for the principal axes of a point cloud
+#define PRINCIPAL_AXES_SWEEPS 16
+
+namespace MH
+{
+    // eigenvectors of a symmetric 3 x 3 matrix by cyclic jacobi rotations, sorted by decreasing eigenvalue
+    inline void compute_principal_axes(const glm::dmat3& covariance, glm::dvec3 axes[3])
+    {
+        double a[3][3];
+        double v[3][3];
+        for(int r = 0; r < 3; r++)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                a[r][c] = covariance[c][r];
+                v[r][c] = r == c ? 1.0 : 0.0;
+            }
+        }
+
+        for(int sweep = 0; sweep < PRINCIPAL_AXES_SWEEPS; sweep++)
+        {
+            double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+            double diagonal = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+            if(off <= 1e-24 * diagonal)
+            {
+                break;
+            }
+
+            for(int p = 0; p < 2; p++)
+            {
+                for(int q = p + 1; q < 3; q++)
+                {
+                    if(a[p][q] == 0.0)
+                    {
+                        continue;
+                    }
+
+                    // rotation by the angle that zeroes a[p][q], t is its tangent
+                    double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0);
+                    double s = t * c;
+
+                    for(int k = 0; k < 3; k++)
+                    {
+                        double kp = a[k][p];
+                        double kq = a[k][q];
+                        a[k][p] = c * kp - s * kq;
+                        a[k][q] = s * kp + c * kq;
+                    }
+                    for(int k = 0; k < 3; k++)
+                    {
+                        double pk = a[p][k];
+                        double qk = a[q][k];
+                        a[p][k] = c * pk - s * qk;
+                        a[q][k] = s * pk + c * qk;
+                    }
+                    for(int k = 0; k < 3; k++)
+                    {
+                        double kp = v[k][p];
+                        double kq = v[k][q];
+                        v[k][p] = c * kp - s * kq;
+                        v[k][q] = s * kp + c * kq;
+                    }
+                }
+            }
+        }
+
+        int order[3] = {0, 1, 2};
+        std::sort(order, order + 3, [&](int x, int y)
+        {
+            return a[x][x] > a[y][y];
+        });
+        for(int i = 0; i < 3; i++)
+        {
+            axes[i] = glm::dvec3(v[0][order[i]], v[1][order[i]], v[2][order[i]]);
+        }
+    }
+
+    // (u, v) in [0, 1]^2 of every point from its projection onto the least squares plane of the cloud,
+    // u runs along the principal axis of largest spread and v along the second one
+    inline void compute_plane_params(const std::vector<glm::vec3>& points, std::vector<glm::vec2>& params)
+    {
+        size_t count = points.size();
+        params.resize(count);
+        if(count == 0)
+        {
+            return;
+        }
+
+        // every pass reduces into one slot per task, summed in task order so the result does not depend on the core count
+        size_t task_count = (count + SURFACE_FIT_POINTS_PER_TASK - 1) / SURFACE_FIT_POINTS_PER_TASK;
+
+        std::vector<glm::dvec3> sums(task_count);
+        ThreadPool::get().parallel_for(count, SURFACE_FIT_POINTS_PER_TASK, [&](size_t begin, size_t end)
+        {
+            glm::dvec3 sum(0.0);
+            for(size_t i = begin; i < end; i++)
+            {
+                sum += glm::dvec3(points[i]);
+            }
+            sums[begin / SURFACE_FIT_POINTS_PER_TASK] = sum;
+        });
+        glm::dvec3 center(0.0);
+        for(auto& sum : sums)
+        {
+            center += sum;
+        }
+        center /= (double)count;
+
+        std::vector<glm::dmat3> covariances(task_count);
+        ThreadPool::get().parallel_for(count, SURFACE_FIT_POINTS_PER_TASK, [&](size_t begin, size_t end)
+        {
+            glm::dmat3 covariance(0.0);
+            for(size_t i = begin; i < end; i++)
+            {
+                glm::dvec3 offset = glm::dvec3(points[i]) - center;
+                covariance += glm::outerProduct(offset, offset);
+            }
+            covariances[begin / SURFACE_FIT_POINTS_PER_TASK] = covariance;
+        });
+        glm::dmat3 covariance(0.0);
+        for(auto& partial : covariances)
+        {
+            covariance += partial;
+        }
+
+        glm::dvec3 axes[3];
+        compute_principal_axes(covariance, axes);
+
+        std::vector<glm::vec2> mins(task_count);
+        std::vector<glm::vec2> maxs(task_count);
+        ThreadPool::get().parallel_for(count, SURFACE_FIT_POINTS_PER_TASK, [&](size_t begin, size_t end)
+        {
+            glm::vec2 min(std::numeric_limits<float>::max());
+            glm::vec2 max(-std::numeric_limits<float>::max());
+            for(size_t i = begin; i < end; i++)
+            {
+                glm::dvec3 offset = glm::dvec3(points[i]) - center;
+                params[i] = glm::vec2(glm::dot(offset, axes[0]), glm::dot(offset, axes[1]));
+                min = glm::min(min, params[i]);
+                max = glm::max(max, params[i]);
+            }
+            mins[begin / SURFACE_FIT_POINTS_PER_TASK] = min;
+            maxs[begin / SURFACE_FIT_POINTS_PER_TASK] = max;
+        });
+        glm::vec2 min = mins[0];
+        glm::vec2 max = maxs[0];
+        for(size_t i = 1; i < task_count; i++)
+        {
+            min = glm::min(min, mins[i]);
+            max = glm::max(max, maxs[i]);
+        }
+
+        glm::vec2 extent = max - min;
+        glm::vec2 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f);
+        ThreadPool::get().parallel_for(count, SURFACE_FIT_POINTS_PER_TASK, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                params[i] = glm::clamp((params[i] - min) * scale, 0.0f, 1.0f);
+            }
+        });
+    }
+
+    // (u, v) in [0, 1]^2 of every point from its closest point on base, rescaled from the domain of base
+    inline void compute_surface_params(const std::vector<glm::vec3>& points, BSplineSurface& base, std::vector<glm::vec2>& params)
+    {
+        size_t count = points.size();
+        params.resize(count);
+
+        glm::vec2 domain_u = base.get_domain_u();
+        glm::vec2 domain_v = base.get_domain_v();
+        glm::vec2 offset(domain_u.x, domain_v.x);
+        glm::vec2 scale(1.0f / (domain_u.y - domain_u.x), 1.0f / (domain_v.y - domain_v.x));
+
+        // closest_points runs in parallel itself, a block at a time bounds the result buffer
+        std::vector<BSplineSurface::SurfacePoint> closest(std::min(count, (size_t)SURFACE_FIT_POINTS_PER_TASK));
+        for(size_t begin = 0; begin < count; begin += SURFACE_FIT_POINTS_PER_TASK)
+        {
+            size_t block = std::min(count - begin, (size_t)SURFACE_FIT_POINTS_PER_TASK);
+            base.closest_points(points.data() + begin, block, closest.data());
+            for(size_t i = 0; i < block; i++)
+            {
+                glm::vec2 param(closest[i].u, closest[i].v);
+                params[begin + i] = glm::clamp((param - offset) * scale, 0.0f, 1.0f);
+            }
+        }
+    }
+
+    // clamped uniform knots over [0, 1]
+    inline void compute_uniform_knots(int control_count, int degree, std::vector<float>& knots)
+    {
+        int segments = control_count - degree;
+        knots.resize(control_count + degree + 1);
+        for(int i = 0; i < (int)knots.size(); i++)
+        {
+            int j = std::min(std::max(i - degree, 0), segments);
+            knots[i] = (float)j / (float)segments;
+        }
+    }
+
+    // least squares surface with control_count_u x control_count_v control points over uniform clamped knots,
+    // points[k] is fitted at params[k], the normal equations are banded with degree_u rows of the net plus degree_v
+    // on each side of the diagonal, assembled one row of the net per task from the points whose u span touches it
+    // and solved by banded cholesky, null when the counts do not fit the degrees or the system is singular
+    inline std::shared_ptr<BSplineSurface> fit_surface(const std::vector<glm::vec3>& points, const std::vector<glm::vec2>& params,
+                                                       int control_count_u, int control_count_v, int degree_u, int degree_v,
+                                                       float smoothing = SURFACE_FIT_SMOOTHING)
+    {
+        size_t count = points.size();
+        assert(params.size() == count);
+        if(count == 0 || degree_u < 1 || degree_v < 1 || degree_u > MAX_BSPLINE_DEGREE || degree_v > MAX_BSPLINE_DEGREE
+           || control_count_u < degree_u + 1 || control_count_v < degree_v + 1)
+        {
+            return nullptr;
+        }
+
+        std::vector<float> knot_u;
+        std::vector<float> knot_v;
+        compute_uniform_knots(control_count_u, degree_u, knot_u);
+        compute_uniform_knots(control_count_v, degree_v, knot_v);
+
+        KnotBreakpoints breakpoints_u;
+        KnotBreakpoints breakpoints_v;
+        breakpoints_u.build(knot_u.data(), knot_u.size(), degree_u);
+        breakpoints_v.build(knot_v.data(), knot_v.size(), degree_v);
+
+        // points bucketed by u span, copies sorted by bucket keep the assembly reading memory in order,
+        // sorted_points[offsets[s] .. offsets[s + 1]) lie in span s
+        std::vector<int> spans(count);
+        ThreadPool::get().parallel_for(count, SURFACE_FIT_POINTS_PER_TASK, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                spans[i] = breakpoints_u.find_span(params[i].x);
+            }
+        });
+
+        std::vector<size_t> offsets(control_count_u + 1, 0);
+        for(size_t i = 0; i < count; i++)
+        {
+            offsets[spans[i] + 1]++;
+        }
+        for(int s = 0; s < control_count_u; s++)
+        {
+            offsets[s + 1] += offsets[s];
+        }
+        std::vector<glm::vec3> sorted_points(count);
+        std::vector<glm::vec2> sorted_params(count);
+        {
+            std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+            for(size_t i = 0; i < count; i++)
+            {
+                size_t k = next[spans[i]]++;
+                sorted_points[k] = points[i];
+                sorted_params[k] = params[i];
+            }
+        }
+        spans = std::vector<int>();
+
+        // unknown i * width + j is control point (i, j), the row major order of the surface net
+        int width = control_count_v;
+        int unknowns = control_count_u * control_count_v;
+        BandedCholeskyFactorization normal;
+        normal.reset(unknowns, degree_u * width + degree_v);
+        Matrix right(unknowns, 3);
+
+        // a point in u span s adds to the equations of net rows s - degree_u ... s, spans degree_u + 1 apart
+        // never share a row, so each pass takes every (degree_u + 1)th span and runs its spans in parallel
+        int span_count = control_count_u - degree_u;
+        for(int pass = 0; pass <= degree_u && pass < span_count; pass++)
+        {
+            size_t pass_spans = (span_count - pass + degree_u) / (degree_u + 1);
+            ThreadPool::get().parallel_for(pass_spans, 1, [&](size_t begin, size_t end)
+            {
+                float basis_u[MAX_BSPLINE_DEGREE + 1];
+                float basis_v[MAX_BSPLINE_DEGREE + 1];
+                for(size_t t = begin; t < end; t++)
+                {
+                    int span_u = degree_u + pass + t * (degree_u + 1);
+                    int first_u = span_u - degree_u;
+                    for(size_t k = offsets[span_u]; k < offsets[span_u + 1]; k++)
+                    {
+                        glm::vec2 param = sorted_params[k];
+                        compute_basis_funcs(knot_u.data(), span_u, degree_u, param.x, basis_u);
+                        int span_v = breakpoints_v.find_span(param.y);
+                        compute_basis_funcs(knot_v.data(), span_v, degree_v, param.y, basis_v);
+                        int first_v = span_v - degree_v;
+                        glm::dvec3 point = sorted_points[k];
+
+                        for(int r = 0; r <= degree_u; r++)
+                        {
+                            for(int a = 0; a <= degree_v; a++)
+                            {
+                                double weight = (double)basis_u[r] * basis_v[a];
+                                int row = (first_u + r) * width + first_v + a;
+                                right(row, 0) += weight * point.x;
+                                right(row, 1) += weight * point.y;
+                                right(row, 2) += weight * point.z;
+
+                                // lower band only, columns of earlier net rows and of this one up to the diagonal,
+                                // a band row is contiguous so columns are addressed from the diagonal entry
+                                double* diagonal = &normal.at(row, row);
+                                for(int s = 0; s <= r; s++)
+                                {
+                                    double weight_s = weight * basis_u[s];
+                                    double* entries = diagonal + ((first_u + s) * width + first_v - row);
+                                    int last = s < r ? degree_v : a;
+                                    for(int b = 0; b <= last; b++)
+                                    {
+                                        entries[b] += weight_s * basis_v[b];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // membrane energy, squared differences of neighbouring control points
+        double membrane = (double)smoothing * count / unknowns;
+        for(int i = 0; i < control_count_u; i++)
+        {
+            for(int j = 0; j < control_count_v; j++)
+            {
+                int a = i * width + j;
+                int neighbours[2] = {i + 1 < control_count_u ? a + width : -1, j + 1 < control_count_v ? a + 1 : -1};
+                for(int b : neighbours)
+                {
+                    if(b < 0)
+                    {
+                        continue;
+                    }
+                    normal.at(a, a) += membrane;
+                    normal.at(b, b) += membrane;
+                    normal.at(b, a) -= membrane;
+                }
+            }
+        }
+
+        if(!normal.factor())
+        {
+            return nullptr;
+        }
+        normal.solve(right);
+
+        auto surface = std::make_shared<BSplineSurface>();
+        surface->degree_u = degree_u;
+        surface->degree_v = degree_v;
+        surface->knot_u = knot_u;
+        surface->knot_v = knot_v;
+        surface->knot_length_u = knot_u.size();
+        surface->knot_length_v = knot_v.size();
+        surface->control_points.resize(unknowns);
+        for(int i = 0; i < unknowns; i++)
+        {
+            surface->control_points[i] = glm::vec4(right(i, 0), right(i, 1), right(i, 2), 1.0f);
+        }
+        surface->compute_derived_date();
+        return surface;
+    }
+
+    // fit_surface with points parameterized over base, or over their least squares plane without one
+    inline std::shared_ptr<BSplineSurface> fit_point_cloud(const std::vector<glm::vec3>& points, int control_count_u, int control_count_v,
+                                                           int degree_u, int degree_v, BSplineSurface* base = nullptr)
+    {
+        std::vector<glm::vec2> params;
+        if(base)
+        {
+            compute_surface_params(points, *base, params);
+        }
+        else
+        {
+            compute_plane_params(points, params);
+        }
+        return fit_surface(points, params, control_count_u, control_count_v, degree_u, degree_v);
+    }
+} // namespace MH
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "shader.h"
+
+namespace MH
+{
+    // shaded surface view, the mesh normals lit by a light at the eye, both sides are lit so open surfaces
+    // read from behind too, same uniforms as the default shader
+    inline Shader* create_surface_shader()
+    {
+        const char* vertex_code = R"(#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 viewNormal;
+
+void main()
+{
+    viewNormal = mat3(view * model) * aNormal;
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
+)";
+
+        const char* fragment_code = R"(#version 330 core
+in vec3 viewNormal;
+
+uniform vec4 customColor;
+
+out vec4 FragColor;
+
+void main()
+{
+    float length_squared = dot(viewNormal, viewNormal);
+    float diffuse = length_squared > 0.0 ? abs(viewNormal.z) * inversesqrt(length_squared) : 1.0;
+    FragColor = vec4(customColor.rgb * (0.3 + 0.7 * diffuse), customColor.a);
+}
+)";
+
+        return Shader::from_source(vertex_code, fragment_code);
+    }
+} // namespace MH